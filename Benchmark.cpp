@@ -0,0 +1,57 @@
+//
+// Times repeated calls to compiled code.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "Benchmark.h"
+
+#include <vector>
+#include <algorithm>
+
+#include "Profiler.h"
+
+namespace ccons {
+
+static uint64_t timeIterations(void (*fn)(void), uint64_t iterations)
+{
+	uint64_t start = Profiler::now();
+	for (uint64_t i = 0; i < iterations; i++)
+		fn();
+	return Profiler::now() - start;
+}
+
+BenchmarkResult runBenchmark(void (*fn)(void),
+                             uint64_t minSampleNs,
+                             unsigned samples)
+{
+	BenchmarkResult result;
+
+	// Warm up caches and lazily compiled callees.
+	fn();
+
+	uint64_t iterations = 1;
+	uint64_t elapsed = timeIterations(fn, iterations);
+	while (elapsed < minSampleNs) {
+		// Aim slightly past the target, but grow by at most 10x per step.
+		uint64_t estimate = elapsed ? iterations * minSampleNs * 12 / 10 / elapsed : 0;
+		iterations = std::min(std::max(estimate, iterations * 2), iterations * 10);
+		elapsed = timeIterations(fn, iterations);
+	}
+
+	std::vector<double> nsPerOp;
+	nsPerOp.push_back((double) elapsed / iterations);
+	for (unsigned i = 1; i < samples; i++)
+		nsPerOp.push_back((double) timeIterations(fn, iterations) / iterations);
+	std::sort(nsPerOp.begin(), nsPerOp.end());
+
+	result.iterations = iterations;
+	result.nsPerOp = nsPerOp[nsPerOp.size() / 2];
+	result.minNsPerOp = nsPerOp[0];
+	return result;
+}
+
+} // namespace ccons
@@ -0,0 +1,32 @@
+#ifndef CCONS_BENCHMARK_H
+#define CCONS_BENCHMARK_H
+
+//
+// Header for Benchmark.cpp, which times repeated calls to compiled code.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include <stdint.h>
+
+namespace ccons {
+
+struct BenchmarkResult {
+	uint64_t iterations; // per sample
+	double nsPerOp;      // median over all samples
+	double minNsPerOp;   // best sample
+};
+
+// Time calls to the specified function. The number of iterations is first
+// calibrated so that a sample takes at least minSampleNs, after which the
+// specified number of samples is taken.
+BenchmarkResult runBenchmark(void (*fn)(void),
+                             uint64_t minSampleNs = 10000000,
+                             unsigned samples = 5);
+
+} // namespace ccons
+
+#endif // CCONS_BENCHMARK_H
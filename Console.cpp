@@ -12,9 +12,14 @@
 
 #include <errno.h>
 #include <ctype.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <iostream>
+#include <fstream>
 #include <map>
 #include <vector>
 #include <sstream>
@@ -25,8 +30,12 @@
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/ExecutionEngine/JIT.h>
+#include <llvm/IR/DataLayout.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/DerivedTypes.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
 
 #include <clang/AST/AST.h>
 #include <clang/Basic/LangOptions.h>
@@ -37,12 +46,22 @@
 #include <clang/Lex/Preprocessor.h>
 #include <clang/Lex/MacroInfo.h>
 
+#include "Benchmark.h"
 #include "ClangUtils.h"
 #include "Diagnostics.h"
+#include "Disassembler.h"
+#include "Executor.h"
+#include "FPControl.h"
+#include "InlineAsm.h"
 #include "InternalCommands.h"
+#include "JITCodeListener.h"
+#include "LayoutPrinter.h"
 #include "Parser.h"
+#include "SlabMemoryManager.h"
 #include "SrcGen.h"
 #include "StringUtils.h"
+#include "ThreadLocalLowering.h"
+#include "ThreadPool.h"
 #include "Visitors.h"
 
 using std::string;
@@ -102,21 +121,137 @@ private:
 
 };
 
+namespace {
+
+// Arguments and result of running a function on the Executor.
+struct FunctionCall {
+	FunctionCall(llvm::ExecutionEngine *engine, llvm::Function *F, bool flushDenormals)
+		: engine(engine), F(F), flushDenormals(flushDenormals) {}
+
+	static void run(void *arg)
+	{
+		FunctionCall *call = (FunctionCall *) arg;
+		SetDenormalsFlushed(call->flushDenormals);
+		std::vector<llvm::GenericValue> params;
+		call->result = call->engine->runFunction(call->F, params);
+	}
+
+	// Runs the call as a statement, as opposed to a background job.
+	static void runStatement(void *arg)
+	{
+		SetStatementThread();
+		run(arg);
+	}
+
+	llvm::ExecutionEngine *engine;
+	llvm::Function *F;
+	bool flushDenormals;
+	llvm::GenericValue result;
+};
+
+// Arguments and result of timing a function on the Executor.
+struct BenchmarkCall {
+	BenchmarkCall(void (*fn)(void), bool flushDenormals)
+		: fn(fn), flushDenormals(flushDenormals) {}
+
+	static void run(void *arg)
+	{
+		BenchmarkCall *call = (BenchmarkCall *) arg;
+		SetStatementThread();
+		SetDenormalsFlushed(call->flushDenormals);
+		call->result = runBenchmark(call->fn);
+	}
+
+	void (*fn)(void);
+	bool flushDenormals;
+	BenchmarkResult result;
+};
+
+// Looks up the instance of a thread-local variable that statements use, on
+// the Executor.
+struct ThreadLocalLookup {
+	ThreadLocalLookup(void *slot, void *init, unsigned long size)
+		: slot(slot), init(init), size(size), instance(NULL) {}
+
+	static void run(void *arg)
+	{
+		ThreadLocalLookup *lookup = (ThreadLocalLookup *) arg;
+		SetStatementThread();
+		lookup->instance = __ccons_tls_get((void **) lookup->slot, lookup->init, lookup->size);
+	}
+
+	void *slot;
+	void *init;
+	unsigned long size;
+	void *instance;
+};
+
+// Returns the name of a signal that can stop the code run by an Executor.
+const char * signalName(int signo)
+{
+	switch (signo) {
+		case SIGINT:  return "SIGINT";
+		case SIGSEGV: return "SIGSEGV";
+		case SIGBUS:  return "SIGBUS";
+		case SIGFPE:  return "SIGFPE";
+		default:      return "a signal";
+	}
+}
+
+// Statements are run on a thread with a stack of this size, unless told
+// otherwise.
+const size_t DefaultStackSize = 64 << 20;
+
+// Returns the number of IR instructions in the specified module.
+unsigned countInstructions(const llvm::Module *module)
+{
+	unsigned count = 0;
+	for (llvm::Module::const_iterator F = module->begin(), FE = module->end();
+	     F != FE; ++F) {
+		for (llvm::Function::const_iterator BB = F->begin(), BE = F->end();
+		     BB != BE; ++BB) {
+			count += BB->size();
+		}
+	}
+	return count;
+}
+
+} // anon namespace
+
 //
 // Console
 //
 
 Console::Console(bool debugMode, std::ostream& out, std::ostream& err) :
 	_debugMode(debugMode),
+	_printTimings(false),
+	_executionEnabled(true),
+	_executionListener(NULL),
+	_executionCancelled(false),
+	_inputFailed(false),
+	_lastInputStatus(InputCompleted),
 	_out(out),
 	_err(err),
 	_raw_err(err),
+	_targetMachine(NULL),
+	_memoryManager(NULL),
+	_hugePages(false),
+	_jitMode(JITAuto),
+	_compilingEagerly(false),
+	_stubsLeft(false),
+	_fastMath(false),
+	_fpContract(ContractOff),
+	_flushDenormals(false),
+	_stackSize(DefaultStackSize),
+	_backgroundJob(NULL),
+	_jobNo(0),
 	_prompt(">>> "),
 	_funcNo(0),
 	_tempFile(NULL)
 {
 	_options.C99 = true;
 	_options.ImplicitInt = false;
+	setLanguageStandard("gnu99");
 
 	_targetOptions.ABI = "";
 	_targetOptions.CPU = "";
@@ -124,12 +259,109 @@ Console::Console(bool debugMode, std::ostream& out, std::ostream& err) :
 	_targetOptions.Triple = LLVM_DEFAULT_TARGET_TRIPLE;
 
 	_parser.reset(new Parser(_options, &_targetOptions));
+	_parser->setProfiler(&_profiler);
 	// Declare exit() so users may call it without needing to #include <stdio.h>
 	_lines.push_back(CodeLine("void exit(int status);", DeclLine));
+	// Likewise for the parallel loops run by the thread pool.
+	RegisterParallelRuntime();
+	_lines.push_back(CodeLine(GetParallelRuntimeDeclarations(), DeclLine));
+	RegisterThreadLocalRuntime();
 }
 
+//
+// Console::Job
+//
+
+struct Console::Job {
+
+	Job(unsigned id, const string& stmt, size_t stackSize)
+		: id(id), stmt(stmt), executor(stackSize), startNs(0), endNs(0) {}
+
+	~Job()
+	{
+		// The types of the results refer to the ASTs.
+		executor.wait();
+		for (unsigned i = 0; i < parseOps.size(); i++)
+			delete parseOps[i];
+	}
+
+	static void run(void *arg)
+	{
+		Job *job = (Job *) arg;
+		for (unsigned i = 0; i < job->calls.size(); i++)
+			FunctionCall::run(&job->calls[i]);
+		job->endNs = Profiler::now();
+	}
+
+	unsigned id;
+	string stmt;
+	std::vector<FunctionCall> calls;
+	std::vector<clang::QualType> types;
+	std::vector<ParseOperation*> parseOps;
+	Executor executor;
+	uint64_t startNs;
+	uint64_t endNs;
+
+};
+
 Console::~Console()
 {
+	// Jobs that are still running are abandoned, as their code goes away
+	// with the console.
+	for (unsigned i = 0; i < _jobs.size(); i++) {
+		_jobs[i]->executor.cancel();
+		delete _jobs[i];
+	}
+	for (unsigned i = 0; i < _asmEngines.size(); i++)
+		delete _asmEngines[i];
+}
+
+void Console::setPrintTimings(bool printTimings)
+{
+	_printTimings = printTimings;
+}
+
+bool Console::setTraceFile(const std::string& path)
+{
+	return _profiler.openTrace(path);
+}
+
+void Console::setStackSize(size_t stackSize)
+{
+	_stackSize = stackSize;
+}
+
+void Console::setHugePages(bool hugePages)
+{
+	_hugePages = hugePages;
+}
+
+void Console::handleInterrupts()
+{
+	getExecutor()->handleInterrupts();
+}
+
+void Console::guardCrashes()
+{
+	Executor::guardCrashes();
+}
+
+Executor * Console::getExecutor()
+{
+	if (!_executor)
+		_executor.reset(new Executor(_stackSize));
+	return _executor.get();
+}
+
+void Console::warmUp()
+{
+	_dp.reset(new DiagnosticsProvider(_raw_err));
+	compileLinkAndRun(genSource(""), "", clang::QualType());
+	_parser->releaseAccumulatedParseOperations();
+	if (_linker)
+		getExecutionEngine();
+	// Initialization is not attributed to any input.
+	_profiler.reset();
 }
 
 const char * Console::prompt() const
@@ -142,11 +374,612 @@ const char * Console::input() const
 	return _input.c_str();
 }
 
+Console::InputStatus Console::lastInputStatus() const
+{
+	return _lastInputStatus;
+}
+
+void Console::setExecutionEnabled(bool enabled)
+{
+	_executionEnabled = enabled;
+}
+
+void Console::setExecutionListener(ExecutionListener *listener)
+{
+	_executionListener = listener;
+}
+
 void Console::reportInputError()
 {
+	_inputFailed = true;
 	_err << "\nNote: Last input ignored due to errors.\n";
 }
 
+bool Console::handleConsoleCommand(const char *line, bool *changedState)
+{
+	// Settings change how later input is compiled or run, so a session
+	// replayed from its journal needs them too.
+	struct {
+		const char *name;
+		void (Console::*handler)(const char *arg);
+		bool setting;
+	}	commands[] = {
+		{ "stats",  &Console::handleStatsCommand,  false },
+		{ "layout", &Console::handleLayoutCommand, false },
+		{ "ir",     &Console::handleIRCommand,     false },
+		{ "asm",    &Console::handleAsmCommand,    false },
+		{ "sweep",  &Console::handleSweepCommand,  false },
+		{ "exec",   &Console::handleExecCommand,   false },
+		{ "bg",     &Console::handleBgCommand,     false },
+		{ "jobs",   &Console::handleJobsCommand,   false },
+		{ "wait",   &Console::handleWaitCommand,   false },
+		{ "threads", &Console::handleThreadsCommand, true },
+		{ "jit",    &Console::handleJITCommand,    true  },
+		{ "std",    &Console::handleStdCommand,    true  },
+		{ "fpmode", &Console::handleFPModeCommand, true  },
+	};
+	const unsigned commandCount = sizeof(commands)/sizeof(commands[0]);
+	for (unsigned i = 0; i < commandCount; i++) {
+		string args;
+		if (MatchInternalCommand(line, commands[i].name, &args)) {
+			(this->*commands[i].handler)(args.c_str());
+			*changedState = commands[i].setting && !args.empty();
+			return true;
+		}
+	}
+	return false;
+}
+
+// Finds the record named by the specified string, which may be a struct or
+// union tag (with or without the keyword), a typedef name or the name of a
+// variable of record type (or array thereof).
+static const clang::RecordDecl * findRecord(clang::ASTContext *context,
+                                            const string& name)
+{
+	string tag = name;
+	bool tagOnly = false;
+	if (tag.find("struct ") == 0 || tag.find("union ") == 0) {
+		tag = tag.substr(tag.find(' ') + 1);
+		while (!tag.empty() && isspace(tag[0]))
+			tag = tag.substr(1);
+		tagOnly = true;
+	}
+
+	clang::QualType type;
+	const clang::RecordDecl *RD = NULL;
+	clang::TranslationUnitDecl *TU = context->getTranslationUnitDecl();
+	for (clang::DeclContext::decl_iterator I = TU->decls_begin(), E = TU->decls_end();
+	     I != E; ++I) {
+		const clang::NamedDecl *ND = llvm::dyn_cast<clang::NamedDecl>(*I);
+		if (!ND || ND->getNameAsString() != tag)
+			continue;
+		if (const clang::RecordDecl *R = llvm::dyn_cast<clang::RecordDecl>(ND)) {
+			if (R->getDefinition())
+				RD = R->getDefinition();
+		} else if (tagOnly) {
+			continue;
+		} else if (const clang::TypedefNameDecl *TD = llvm::dyn_cast<clang::TypedefNameDecl>(ND)) {
+			type = TD->getUnderlyingType();
+		} else if (const clang::VarDecl *VD = llvm::dyn_cast<clang::VarDecl>(ND)) {
+			type = VD->getType();
+		}
+	}
+
+	if (!type.isNull()) {
+		type = context->getBaseElementType(type);
+		if (const clang::RecordType *RT = type->getAs<clang::RecordType>())
+			RD = RT->getDecl()->getDefinition();
+	}
+
+	return RD;
+}
+
+void Console::handleLayoutCommand(const char *arg)
+{
+	if (!*arg) {
+		oprintf(_err, "Usage: :layout <struct type or variable>\n");
+		return;
+	}
+
+	_dp.reset(new DiagnosticsProvider(_raw_err));
+	string src = genSource("");
+	ParseOperation *parseOp = _parser->createParseOperation(_dp->getDiagnosticsEngine());
+	_dp->BeginSourceFile(_options, parseOp->getPreprocessor());
+	clang::ASTConsumer consumer;
+	_parser->parse(src, parseOp, &consumer);
+
+	clang::ASTContext *context = parseOp->getASTContext();
+	if (const clang::RecordDecl *RD = findRecord(context, arg)) {
+		clang::PrintingPolicy PP(_options);
+		PP.AnonymousTagLocations = false;
+		printRecordLayout(_out, PP, *context, RD);
+	} else {
+		oprintf(_err, "No struct or union named '%s' was found.\n", arg);
+	}
+	_parser->releaseAccumulatedParseOperations();
+}
+
+llvm::Function * Console::findDefinedFunction(const char *name)
+{
+	llvm::Function *F = _linkerModule ? _linkerModule->getFunction(name) : NULL;
+	if (F && F->isDeclaration()) {
+		// Functions of inputs with inline assembly are only declared; they
+		// are defined in the module that MCJIT compiled, the latest first.
+		for (unsigned i = _asmEngines.size(); i > 0; i--) {
+			llvm::Function *asmF = _asmEngines[i - 1]->FindFunctionNamed(name);
+			if (asmF && !asmF->isDeclaration())
+				return asmF;
+		}
+	}
+	if (!F || F->isDeclaration()) {
+		oprintf(_err, "No function named '%s' has been compiled.\n", name);
+		return NULL;
+	}
+	return F;
+}
+
+void * Console::lookupSymbol(const char *name)
+{
+	if (!_linkerModule)
+		return NULL;
+	if (llvm::Function *F = _linkerModule->getFunction(name)) {
+		// Functions of inputs with inline assembly are only declared.
+		if (F->isDeclaration())
+			return _engine ? _engine->getPointerToGlobalIfAvailable(F) : NULL;
+		compileFunction(F);
+		return _engine->getPointerToFunction(F);
+	}
+	if (llvm::GlobalVariable *GV = _linkerModule->getNamedGlobal(name)) {
+		if (GV->isDeclaration())
+			return NULL;
+		llvm::ExecutionEngine *engine = getExecutionEngine();
+		llvm::GlobalVariable *slot = GetThreadLocalSlot(_linkerModule.get(), GV);
+		if (!slot)
+			return engine->getPointerToGlobal(GV);
+		// A thread-local variable only holds its initial value.
+		llvm::Type *type = GV->getType()->getElementType();
+		ThreadLocalLookup lookup(engine->getPointerToGlobal(slot), engine->getPointerToGlobal(GV),
+		                         engine->getDataLayout()->getTypeAllocSize(type));
+		return getExecutor()->run(ThreadLocalLookup::run, &lookup) ? lookup.instance : NULL;
+	}
+	return NULL;
+}
+
+void Console::handleIRCommand(const char *arg)
+{
+	if (llvm::Function *F = findDefinedFunction(arg)) {
+		llvm::raw_os_ostream out(_out);
+		F->print(out);
+	}
+}
+
+void Console::handleAsmCommand(const char *arg)
+{
+	llvm::Function *F = findDefinedFunction(arg);
+	if (!F)
+		return;
+	if (F->getParent() != _linkerModule.get()) {
+		oprintf(_err, "'%s' was compiled by MCJIT, as its input has inline assembly; "
+		              "only code emitted by the JIT can be disassembled.\n", arg);
+		return;
+	}
+
+	// Functions are compiled lazily, so make sure this one has been emitted.
+	compileFunction(F);
+	const JITCodeListener::CodeRange *range = _codeListener->getCodeRange(arg);
+	if (!range) {
+		oprintf(_err, "No machine code was found for '%s'.\n", arg);
+		return;
+	}
+
+	string error;
+	if (!disassemble(_out, _targetOptions.Triple, llvm::sys::getHostCPUName(),
+	                 (const uint8_t *) range->start, range->size, &error)) {
+		oprintf(_err, "Error: %s\n", error.c_str());
+	}
+}
+
+// Gets the range of values that :sweep can store into a global variable of
+// the specified type. Returns false if it is not of an integer or floating
+// point type.
+static bool getSweepRange(llvm::Type *type, long long *min, long long *max)
+{
+	if (type->isFloatTy() || type->isDoubleTy()) {
+		*min = LLONG_MIN;
+		*max = LLONG_MAX;
+		return true;
+	}
+	if (!type->isIntegerTy(8) && !type->isIntegerTy(16) &&
+	    !type->isIntegerTy(32) && !type->isIntegerTy(64))
+		return false;
+	unsigned bits = type->getIntegerBitWidth();
+	*max = bits == 64 ? LLONG_MAX : (1LL << (bits - 1)) - 1;
+	*min = -*max - 1;
+	return true;
+}
+
+// Stores value into the global variable at addr, of a type that
+// getSweepRange() accepts.
+static void storeSweepValue(void *addr, llvm::Type *type, long long value)
+{
+	if (type->isIntegerTy(8))
+		*(int8_t *) addr = value;
+	else if (type->isIntegerTy(16))
+		*(int16_t *) addr = value;
+	else if (type->isIntegerTy(32))
+		*(int32_t *) addr = value;
+	else if (type->isIntegerTy(64))
+		*(int64_t *) addr = value;
+	else if (type->isFloatTy())
+		*(float *) addr = value;
+	else
+		*(double *) addr = value;
+}
+
+// Parses a whole decimal number, with an optional sign.
+static bool parseSweepNumber(const string& text, long long *value)
+{
+	if (text.empty())
+		return false;
+	char *end;
+	errno = 0;
+	*value = strtoll(text.c_str(), &end, 10);
+	return !*end && errno != ERANGE;
+}
+
+void Console::handleSweepCommand(const char *arg)
+{
+	std::istringstream args(arg);
+	string csvFile, var, range, step;
+	args >> var;
+	if (var.find("--csv=") == 0) {
+		csvFile = var.substr(sizeof("--csv=") - 1);
+		args >> var;
+	}
+	args >> range;
+	args >> std::ws;
+	if (args.peek() == '*' || args.peek() == '+')
+		args >> step;
+	string stmt;
+	std::getline(args, stmt, '\0');
+
+	// Values are multiplied by a factor of at least two, which only grows
+	// them if they are positive, or added a positive step to.
+	long long start, end, factor = 2, increment = 0;
+	bool valid = false;
+	string::size_type dots = range.find("..");
+	if (dots != string::npos && parseSweepNumber(range.substr(0, dots), &start) &&
+	    parseSweepNumber(range.substr(dots + 2), &end) && start <= end) {
+		if (step.empty()) {
+			valid = start > 0;
+		} else if (step[0] == '*') {
+			valid = parseSweepNumber(step.substr(1), &factor) && factor >= 2 && start > 0;
+		} else {
+			valid = parseSweepNumber(step.substr(1), &increment) && increment > 0;
+			factor = 0;
+		}
+	}
+	if (var.empty() || stmt.empty() || !valid) {
+		oprintf(_err, "Usage: :sweep [--csv=<file>] <var> <start>..<end> [*factor|+step] <stmt>\n"
+		              "  start must be positive unless stepping by +step, and factor at least 2\n");
+		return;
+	}
+
+	// The variable is checked before anything is compiled or printed.
+	llvm::GlobalVariable *GV = _linkerModule ? _linkerModule->getNamedGlobal(var) : NULL;
+	if (!GV) {
+		oprintf(_err, "No global variable named '%s' was found.\n", var.c_str());
+		return;
+	}
+	llvm::Type *type = GV->getType()->getElementType();
+	long long min, max;
+	if (!getSweepRange(type, &min, &max)) {
+		oprintf(_err, "Variable '%s' is not of an integer or floating point type.\n",
+		        var.c_str());
+		return;
+	}
+	if (start < min || end > max) {
+		oprintf(_err, "The values %lld..%lld do not fit in variable '%s'.\n",
+		        start, end, var.c_str());
+		return;
+	}
+
+	// Compile the statement once, into a function of its own.
+	string fName = "__ccons_sweep" + to_string(_funcNo++);
+	_dp.reset(new DiagnosticsProvider(_raw_err));
+	string src = genSource("");
+	src += "void " + fName + "(void) {\n" + stmt + "\n}\n";
+	clang::QualType retType((clang::Type *) NULL, 0);
+	bool compiled = compileLinkAndRun(src, "", retType);
+	_parser->releaseAccumulatedParseOperations();
+	if (!compiled)
+		return;
+
+	llvm::Module *module = _linker->getModule();
+	llvm::ExecutionEngine *engine = getExecutionEngine();
+	void *addr = engine->getPointerToGlobal(GV);
+	llvm::Function *F = module->getFunction(fName);
+	compileFunction(F);
+	void (*fn)(void) = (void (*)(void)) engine->getPointerToFunction(F);
+
+	std::ofstream csv;
+	if (!csvFile.empty()) {
+		csv.open(csvFile.c_str());
+		if (!csv) {
+			oprintf(_err, "Could not open '%s' for writing.\n", csvFile.c_str());
+			return;
+		}
+		csv << var << ",ns_per_op,min_ns_per_op,iterations\n";
+	} else {
+		oprintf(_out, "%14s %14s %14s %12s\n", var.c_str(), "ns/op", "min ns/op", "iterations");
+	}
+
+	std::vector<char> saved(engine->getDataLayout()->getTypeAllocSize(type));
+	memcpy(&saved[0], addr, saved.size());
+	for (long long value = start; ; ) {
+		storeSweepValue(addr, type, value);
+		// The statement is timed where statements are run, so that it can be
+		// interrupted and gets the same stack.
+		BenchmarkCall call(fn, _flushDenormals);
+		if (!getExecutor()->run(BenchmarkCall::run, &call)) {
+			int signo = getExecutor()->stopSignal();
+			if (signo == SIGINT)
+				oprintf(_err, "Interrupted.\n");
+			else
+				oprintf(_err, "Error: The statement was stopped by %s.\n", signalName(signo));
+			break;
+		}
+		const BenchmarkResult& result = call.result;
+		if (csv.is_open()) {
+			csv << value << "," << result.nsPerOp << "," << result.minNsPerOp
+			    << "," << result.iterations << "\n";
+		} else {
+			oprintf(_out, "%14lld %14.2f %14.2f %12llu\n", value, result.nsPerOp,
+			        result.minNsPerOp, (unsigned long long) result.iterations);
+		}
+
+		// Stop before the next value would pass end, or overflow.
+		if (factor ? value > end / factor
+		           : (unsigned long long) end - value < (unsigned long long) increment)
+			break;
+		value = factor ? value * factor : value + increment;
+	}
+	memcpy(addr, &saved[0], saved.size());
+
+	if (csv.is_open())
+		oprintf(_out, "Results written to '%s'.\n", csvFile.c_str());
+}
+
+void Console::handleStatsCommand(const char *arg)
+{
+	if (!strcmp(arg, "reset")) {
+		_profiler.reset();
+		oprintf(_out, "Statistics reset.\n");
+	} else {
+		_profiler.printStats(_out);
+	}
+}
+
+void Console::handleExecCommand(const char *arg)
+{
+	if (!strcmp(arg, "on")) {
+		setExecutionEnabled(true);
+	} else if (!strcmp(arg, "off")) {
+		setExecutionEnabled(false);
+	} else if (*arg) {
+		oprintf(_err, "Usage: :exec [on|off]\n");
+		return;
+	}
+	oprintf(_out, "Statements are %s.\n", _executionEnabled ? "run" : "compiled but not run");
+}
+
+void Console::handleBgCommand(const char *arg)
+{
+	if (!*arg) {
+		oprintf(_err, "Usage: :bg <stmt>\n");
+		return;
+	}
+	if (!_executionEnabled) {
+		oprintf(_err, "Statements are not being run (see :exec).\n");
+		return;
+	}
+
+	// The statement goes through the usual pipeline, except that the
+	// functions to call are collected by compileLinkAndRun() into the job.
+	llvm::OwningPtr<Job> job(new Job(_jobNo + 1, arg,
+		_stackSize ? _stackSize : DefaultStackSize));
+	_backgroundJob = job.get();
+	_inputFailed = false;
+	_executionCancelled = false;
+	processInput(arg);
+	_backgroundJob = NULL;
+
+	if (!_buffer.empty()) {
+		oprintf(_err, "The statement to run in the background is incomplete.\n");
+		_buffer.clear();
+		_prompt = ">>> ";
+		_input = "";
+	} else if (!_inputFailed && job->calls.empty()) {
+		oprintf(_err, "There is nothing to run in the background.\n");
+	}
+	if (!_buffer.empty() || _inputFailed || job->calls.empty()) {
+		_parser->releaseAccumulatedParseOperations();
+		return;
+	}
+
+	_parser->takeAccumulatedParseOperations(&job->parseOps);
+	job->startNs = Profiler::now();
+	if (!job->executor.start(Job::run, job.get())) {
+		oprintf(_err, "Could not start a thread for the job.\n");
+		return;
+	}
+	_jobNo++;
+	oprintf(_out, "[%u] %s\n", job->id, job->stmt.c_str());
+	_jobs.push_back(job.take());
+}
+
+void Console::handleJobsCommand(const char *arg)
+{
+	if (_jobs.empty()) {
+		oprintf(_out, "No jobs.\n");
+		return;
+	}
+	uint64_t now = Profiler::now();
+	for (unsigned i = 0; i < _jobs.size(); i++) {
+		Job *job = _jobs[i];
+		bool busy = job->executor.isBusy();
+		if (!busy && !job->endNs) {
+			// Its thread did not survive a fork, e.g. into a checkpoint.
+			oprintf(_out, "[%u] %-8s %10s  %s\n", job->id, "lost", "", job->stmt.c_str());
+			continue;
+		}
+		double seconds = ((busy ? now : job->endNs) - job->startNs) / 1e9;
+		oprintf(_out, "[%u] %-8s %9.2fs  %s\n", job->id,
+		        busy ? "running" : "done", seconds, job->stmt.c_str());
+	}
+}
+
+void Console::handleWaitCommand(const char *arg)
+{
+	char *end;
+	unsigned long id = strtoul(arg, &end, 10);
+	if (!*arg || *end) {
+		oprintf(_err, "Usage: :wait <job id>\n");
+		return;
+	}
+	std::vector<Job*>::iterator it = _jobs.begin();
+	while (it != _jobs.end() && (*it)->id != id)
+		++it;
+	if (it == _jobs.end()) {
+		oprintf(_err, "No job with id %lu.\n", id);
+		return;
+	}
+
+	// Ctrl-C stops waiting, but leaves the job running.
+	Job *job = *it;
+	bool interrupted = false;
+	bool completed = job->executor.waitUnlessInterrupted(&interrupted);
+	if (interrupted) {
+		oprintf(_err, "[%u] Still running.\n", job->id);
+		return;
+	}
+	_jobs.erase(it);
+	if (!completed || !job->endNs) {
+		if (int signo = job->executor.stopSignal())
+			oprintf(_err, "[%u] Stopped by %s.\n", job->id, signalName(signo));
+		else
+			oprintf(_err, "[%u] Did not complete.\n", job->id);
+		delete job;
+		return;
+	}
+	oprintf(_out, "[%u] Done in %.2fs.\n", job->id, (job->endNs - job->startNs) / 1e9);
+	for (unsigned i = 0; i < job->calls.size(); i++) {
+		if (!job->types[i].isNull() && job->types[i].getTypePtr())
+			printGV(job->calls[i].F, job->calls[i].result, job->types[i]);
+	}
+	delete job;
+}
+
+void Console::handleThreadsCommand(const char *arg)
+{
+	if (*arg) {
+		char *end;
+		unsigned long threads = strtoul(arg, &end, 10);
+		if (*end || threads < 1 || threads > 1024) {
+			oprintf(_err, "Usage: :threads [n]\n");
+			return;
+		}
+		ThreadPool::instance()->setSize(threads);
+	}
+	unsigned threads = ThreadPool::instance()->size();
+	oprintf(_out, "Parallel loops run on %u thread%s.\n", threads, threads == 1 ? "" : "s");
+}
+
+void Console::handleJITCommand(const char *arg)
+{
+	if (!strcmp(arg, "lazy")) {
+		setJITMode(JITLazy);
+	} else if (!strcmp(arg, "eager")) {
+		setJITMode(JITEager);
+	} else if (!strcmp(arg, "auto")) {
+		setJITMode(JITAuto);
+	} else if (*arg) {
+		oprintf(_err, "Usage: :jit [eager|lazy|auto]\n");
+		return;
+	}
+	oprintf(_out, "Functions are compiled %s%s.\n",
+	        _compilingEagerly || _jitMode == JITEager ? "eagerly" : "lazily",
+	        _jitMode == JITAuto && !_compilingEagerly ? " (eagerly once threads are in use)" : "");
+}
+
+bool Console::setLanguageStandard(const std::string& standard)
+{
+	static const struct {
+		const char *name;
+		bool c11;
+		bool gnu;
+	} standards[] = {
+		{ "c99",   false, false },
+		{ "gnu99", false, true  },
+		{ "c11",   true,  false },
+		{ "gnu11", true,  true  },
+	};
+	for (unsigned i = 0; i < sizeof(standards) / sizeof(standards[0]); i++) {
+		if (standard == standards[i].name) {
+			// Every parse operation copies the options when it is created, so
+			// the input parsed before keeps its standard.
+			_options.C11 = standards[i].c11;
+			_options.GNUMode = standards[i].gnu;
+			_options.GNUKeywords = standards[i].gnu;
+			_standard = standard;
+			return true;
+		}
+	}
+	return false;
+}
+
+void Console::handleStdCommand(const char *arg)
+{
+	if (*arg && !setLanguageStandard(arg)) {
+		oprintf(_err, "Usage: :std [c99|gnu99|c11|gnu11]\n");
+		return;
+	}
+	oprintf(_out, "Input is parsed as %s.\n", _standard.c_str());
+}
+
+void Console::handleFPModeCommand(const char *arg)
+{
+	bool fastMath = _fastMath;
+	FPContraction contract = _fpContract;
+	bool flushDenormals = _flushDenormals;
+	std::istringstream in(arg);
+	string setting;
+	while (in >> setting) {
+		if (setting == "fast-math=on" || setting == "fast-math=off") {
+			fastMath = setting == "fast-math=on";
+		} else if (setting == "contract=off") {
+			contract = ContractOff;
+		} else if (setting == "contract=on") {
+			contract = ContractOn;
+		} else if (setting == "contract=fast") {
+			contract = ContractFast;
+		} else if (setting == "ftz=on" || setting == "ftz=off") {
+			flushDenormals = setting == "ftz=on";
+		} else {
+			oprintf(_err, "Usage: :fpmode [fast-math=on|off] [contract=off|on|fast] [ftz=on|off]\n");
+			return;
+		}
+	}
+	_fastMath = fastMath;
+	_fpContract = contract;
+	_flushDenormals = flushDenormals;
+	applyFPMode();
+
+	static const char *contractNames[] = { "off", "on", "fast" };
+	oprintf(_out, "fast-math=%s contract=%s ftz=%s\n", _fastMath ? "on" : "off",
+	        contractNames[_fpContract], _flushDenormals ? "on" : "off");
+}
+
 string Console::genSource(const std::string& appendix) const
 {
 	string src;
@@ -174,6 +1007,7 @@ int Console::splitInput(const string& source,
 	src += input;
 	src += "\n}\n";
 
+	ScopedPhase phase(&_profiler, Profiler::SplitInput);
 	// Set offset on the diagnostics provider.
 	_dp->setOffset(pos);
 	std::vector<clang::Stmt*> stmts;
@@ -213,6 +1047,7 @@ clang::Stmt * Console::locateStmt(const std::string& line,
 	*src += line;
 	*src += "\n}\n";
 
+	ScopedPhase phase(&_profiler, Profiler::LocateStmt);
 	// Set offset on the diagnostics provider.
 	_dp->setOffset(pos);
 	ParseOperation *parseOp = _parser->createParseOperation(_dp->getDiagnosticsEngine());
@@ -329,6 +1164,13 @@ void Console::processVarDecl(const string& src,
 			decl = orig.substr(0, assignIndex);
 		}
 	}
+	// The declaration is rebuilt from the type, which does not carry the
+	// alignment that _Alignas or the aligned attribute asked for.
+	if (VD->hasAttr<clang::AlignedAttr>()) {
+		std::stringstream aligned;
+		aligned << " __attribute__((aligned(" << context->getDeclAlign(VD).getQuantity() << ")))";
+		decl += aligned.str();
+	}
 	if (const clang::Expr *I = VD->getInit()) {
 		SrcRange range = getStmtRange(I, *sm, _options);
 		if (I->isConstantInitializer(*context, false)) {
@@ -459,23 +1301,86 @@ string Console::genAppendix(const char *source,
 }
 
 void Console::process(const char *line)
+{
+	if (_buffer.empty()) {
+		if (HandleInternalCommand(line, _debugMode, _out, _err)) {
+			_lastInputStatus = InputCompleted;
+			return;
+		}
+		bool changedState;
+		if (handleConsoleCommand(line, &changedState)) {
+			_lastInputStatus = changedState ? InputCompleted : InputQuery;
+			return;
+		}
+		_profiler.beginInput();
+		_inputFailed = false;
+		_executionCancelled = false;
+	}
+
+	processInput(line);
+	updateCounters();
+	_parser->releaseAccumulatedParseOperations();
+
+	// The input is complete once nothing is left buffered.
+	if (_buffer.empty()) {
+		_profiler.endInput();
+		if (_printTimings)
+			_profiler.printLastInput(_err);
+		_lastInputStatus = _inputFailed ? InputFailed : InputCompleted;
+	} else {
+		_lastInputStatus = InputIncomplete;
+	}
+	// The ASTs of the input were only counted until they were released.
+	_profiler.setCounter(Profiler::ASTBytes, getASTMemory());
+}
+
+size_t Console::getASTMemory() const
+{
+	size_t bytes = _parser->getAccumulatedASTMemory();
+	for (unsigned i = 0; i < _jobs.size(); i++) {
+		for (unsigned j = 0; j < _jobs[i]->parseOps.size(); j++)
+			bytes += _jobs[i]->parseOps[j]->getASTMemory();
+	}
+	return bytes;
+}
+
+void Console::updateCounters()
+{
+	_profiler.setCounter(Profiler::ASTBytes, getASTMemory());
+	if (_codeListener)
+		_profiler.setCounter(Profiler::JITCodeBytes, _codeListener->getTotalCodeBytes());
+	if (_memoryManager) {
+		_profiler.setCounter(Profiler::JITDataBytes, _memoryManager->getDataBytes());
+		_profiler.setCounter(Profiler::JITMappedBytes, _memoryManager->getMappedBytes());
+	}
+	size_t linesBytes = 0;
+	for (unsigned i = 0; i < _lines.size(); ++i)
+		linesBytes += _lines[i].first.length();
+	_profiler.setCounter(Profiler::LinesBytes, linesBytes);
+}
+
+void Console::processInput(const char *line)
 {
 	std::vector<CodeLine> linesToAppend;
 	bool hadErrors = false;
 	string appendix;
 
-	if (_buffer.empty() && HandleInternalCommand(line, _debugMode, _out, _err))
-		return;
-
 	_dp.reset(new DiagnosticsProvider(_raw_err));
 
 	string src = genSource("");	
 
 	_buffer += line;
+	_profiler.setInputSize(_buffer.length());
 	int indentLevel;
 	std::vector<clang::FunctionDecl *> fnDecls;
+	std::vector<clang::VarDecl *> tlsVars;
 	bool shouldBeTopLevel = false;
-	switch (_parser->analyzeInput(src, _buffer, indentLevel, &fnDecls)) {
+	Parser::InputType inputType;
+	{
+		ScopedPhase phase(&_profiler, Profiler::AnalyzeInput);
+		inputType = _parser->analyzeInput(src, _buffer, indentLevel, &fnDecls, &tlsVars);
+	}
+	switch (inputType) {
 		case Parser::Incomplete:
 			_input = string(indentLevel * 2, ' ');
 			_prompt = "... ";
@@ -509,6 +1414,15 @@ void Console::process(const char *line)
 		} else if (appendix[0] == '#') {
 			linesToAppend.push_back(CodeLine(appendix, PrprLine));
 		}
+		// Thread-local variables are defined as they were typed, and declared
+		// for later inputs with their thread storage class.
+		for (unsigned i = 0; i < tlsVars.size(); ++i) {
+			clang::PrintingPolicy PP(_options);
+			PP.AnonymousTagLocations = false;
+			linesToAppend.push_back(CodeLine("extern __thread " +
+				genVarDecl(PP, tlsVars[i]->getType(), tlsVars[i]->getName().str()) + ";",
+				DeclLine));
+		}
 
 		if (hadErrors)
 			return;
@@ -541,7 +1455,7 @@ void Console::process(const char *line)
 		}
 		_buffer.clear();
 
-		for (unsigned i = 0; i < split.size(); i++) {
+		for (unsigned i = 0; i < split.size() && !_executionCancelled; i++) {
 			string fName;
 			clang::QualType retType((clang::Type *) NULL, 0);
 			appendix = genAppendix(src.c_str(), split[i].c_str(), &fName, retType, &linesToAppend, &hadErrors);
@@ -561,7 +1475,136 @@ void Console::process(const char *line)
 			}
 		}
 	}
-	_parser->releaseAccumulatedParseOperations();
+}
+
+llvm::ExecutionEngine * Console::getExecutionEngine()
+{
+	if (!_engine) {
+		llvm::EngineBuilder builder(_linker->getModule());
+		builder.setTargetOptions(getTargetOptions());
+		_memoryManager = new SlabMemoryManager(_hugePages);
+		builder.setJITMemoryManager(_memoryManager);
+		_targetMachine = builder.selectTarget();
+		_engine.reset(builder.create(_targetMachine));
+		assert(_engine && "Could not create ExecutionEngine!");
+		_codeListener.reset(new JITCodeListener);
+		_engine->RegisterJITEventListener(_codeListener.get());
+	}
+	return _engine.get();
+}
+
+// Returns the options that the JIT generates code with.
+llvm::TargetOptions Console::getTargetOptions() const
+{
+	llvm::TargetOptions options;
+	options.UnsafeFPMath = _fastMath;
+	options.NoInfsFPMath = _fastMath;
+	options.NoNaNsFPMath = _fastMath;
+	options.LessPreciseFPMADOption = _fastMath;
+	options.AllowFPOpFusion = _fpContract == ContractFast ?
+		llvm::FPOpFusion::Fast : llvm::FPOpFusion::Standard;
+	return options;
+}
+
+// Makes the code compiled from now on, and the statements run from now on,
+// follow the floating-point mode set by :fpmode.
+void Console::applyFPMode()
+{
+	_options.FastMath = _fastMath;
+	_options.FiniteMathOnly = _fastMath;
+	_options.DefaultFPContract = _fpContract != ContractOff;
+	// The code generator consults the options of the target machine as it
+	// compiles each function.
+	if (_targetMachine)
+		_targetMachine->Options = getTargetOptions();
+}
+
+void Console::setJITMode(JITMode mode)
+{
+	_jitMode = mode;
+	if (mode == JITEager) {
+		startCompilingEagerly();
+	} else if (mode == JITLazy) {
+		_compilingEagerly = false;
+	}
+}
+
+// Returns true if the code compiled so far may run on several threads.
+bool Console::usesThreads() const
+{
+	static const char *functions[] = {
+		"pthread_create",
+		"thrd_create",
+		"ccons_parallel_for",
+		"ccons_parallel_reduce",
+	};
+	if (!_jobs.empty() || _backgroundJob)
+		return true;
+	for (unsigned i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+		llvm::Function *F = _linkerModule->getFunction(functions[i]);
+		if (F && !F->use_empty())
+			return true;
+	}
+	return false;
+}
+
+void Console::startCompilingEagerly()
+{
+	_compilingEagerly = true;
+	compileStubbedCode();
+}
+
+// Makes sure that no code compiled so far calls into the JIT. Code compiled
+// lazily calls functions through stubs, which compile them on their first
+// call; recompiling it leaves no stubs behind, and the old code of each
+// function jumps to the new one. Functions that only stubs refer to, such
+// as those whose address was taken, are compiled as well.
+void Console::compileStubbedCode()
+{
+	if (!_engine || !_stubsLeft)
+		return;
+	_engine->DisableLazyCompilation(true);
+	for (llvm::Module::iterator F = _linkerModule->begin(), E = _linkerModule->end();
+	     F != E; ++F) {
+		if (F->isDeclaration())
+			continue;
+		if (_engine->getPointerToGlobalIfAvailable(F))
+			_engine->recompileAndRelinkFunction(F);
+		else
+			_engine->getPointerToFunction(F);
+	}
+	_engine->DisableLazyCompilation(false);
+	_stubsLeft = false;
+}
+
+// Compiles the specified function. When compiling eagerly, every function
+// it can reach, directly or through function pointers, is compiled along
+// with it, so that none of its code needs the JIT once it runs.
+//
+// Lazy compilation is only ever disabled for the duration of this call:
+// stubs made before compiling eagerly, such as those that function pointers
+// saved in variables refer to, may still be called later, and the JIT
+// aborts if one is called while lazy compilation is disabled.
+void Console::compileFunction(llvm::Function *F)
+{
+	llvm::ExecutionEngine *engine = getExecutionEngine();
+	if (!_compilingEagerly && _jitMode == JITAuto && usesThreads()) {
+		if (_debugMode)
+			oprintf(_err, "Threads are in use; compiling eagerly from now on.\n");
+		startCompilingEagerly();
+	}
+
+	// The console goes on using the JIT while a background job runs, so
+	// everything the job may call is compiled up front, whatever the mode,
+	// including what earlier code only reaches through stubs.
+	bool eager = _compilingEagerly || _backgroundJob;
+	if (_backgroundJob)
+		compileStubbedCode();
+	engine->DisableLazyCompilation(eager);
+	engine->getPointerToFunction(F);
+	engine->DisableLazyCompilation(false);
+	if (!eager)
+		_stubsLeft = true;
 }
 
 bool Console::compileLinkAndRun(const string& src,
@@ -574,6 +1617,10 @@ bool Console::compileLinkAndRun(const string& src,
 	llvm::OwningPtr<clang::CodeGenerator> codegen;
 	clang::CodeGenOptions codeGenOptions;
 	codeGenOptions.InstrumentFunctions = false;
+	codeGenOptions.UnsafeFPMath = _fastMath;
+	codeGenOptions.NoInfsFPMath = _fastMath;
+	codeGenOptions.NoNaNsFPMath = _fastMath;
+	codeGenOptions.LessPreciseFPMAD = _fastMath;
 	codegen.reset(CreateLLVMCodeGen(*_dp->getDiagnosticsEngine(), "-", codeGenOptions, _targetOptions, _context));
 	if (_debugMode)
 		oprintf(_err, "Parsing in compileLinkAndRun()...\n");
@@ -582,7 +1629,11 @@ bool Console::compileLinkAndRun(const string& src,
 	  _parser->createParseOperation(_dp->getDiagnosticsEngine(), _macros);
 	_dp->BeginSourceFile(_options, parseOp->getPreprocessor());
 	_macros->setSourceManager(parseOp->getSourceManager());
-	_parser->parse(src, parseOp, codegen.get());
+	{
+		ScopedPhase phase(&_profiler, Profiler::Parse);
+		ProfilingConsumer consumer(codegen.get(), &_profiler, Profiler::CodeGen);
+		_parser->parse(src, parseOp, &consumer);
+	}
 	if (_dp->getDiagnosticsEngine()->hasErrorOccurred()) {
 		reportInputError();
 		return false;
@@ -590,31 +1641,87 @@ bool Console::compileLinkAndRun(const string& src,
 
 	llvm::Module *module = codegen->ReleaseModule();
 	if (module) {
+		ScopedPhase linkPhase(&_profiler, Profiler::Link);
 		if (!_linker) {
 			_linkerModule.reset(new llvm::Module("ccons", _context));
 			_linker.reset(new llvm::Linker(_linkerModule.get()));
 		}
+		_profiler.addToCounter(Profiler::ModuleInsts, countInstructions(module));
+		LowerThreadLocals(module, _linkerModule.get());
+		llvm::Module *asmModule = NULL;
+		if (UsesInlineAsm(module))
+			asmModule = SplitInlineAsm(module);
 		string error;
 		_linker->linkInModule(module, llvm::Linker::DestroySource, &error);
 		if (!error.empty()) {
+			delete asmModule;
 			oprintf(_err, "Error: %s\n", error.c_str());
 			reportInputError();
 			return false;
 		}
+		llvm::ExecutionEngine *asmEngine = NULL;
+		if (asmModule) {
+			if (_debugMode)
+				oprintf(_err, "Compiling inline assembly with MCJIT.\n");
+			ScopedPhase phase(&_profiler, Profiler::JIT);
+			asmEngine = CompileInlineAsm(asmModule, getExecutionEngine(), _linkerModule.get(),
+			                             getTargetOptions(), &error);
+			if (!asmEngine) {
+				oprintf(_err, "Error: %s\n", error.c_str());
+				reportInputError();
+				return false;
+			}
+			_asmEngines.push_back(asmEngine);
+		}
 		// link it with the existing ones
-		if (!fName.empty()) {
+		if (!fName.empty() && _executionEnabled) {
 			module = _linker->getModule();
-			if (!_engine)
-				_engine.reset(llvm::ExecutionEngine::create(module));
-			assert(_engine && "Could not create ExecutionEngine!");
-			llvm::Function *F = module->getFunction(fName.c_str());
-			assert(F && "Function was not found!");
-			std::vector<llvm::GenericValue> params;
+			llvm::Function *F;
+			{
+				ScopedPhase phase(&_profiler, Profiler::JIT);
+				F = module->getFunction(fName.c_str());
+				assert(F && "Function was not found!");
+				compileFunction(F);
+			}
+			if (_executionListener && !_executionListener->willExecute(fName)) {
+				if (_debugMode)
+					oprintf(_err, "Call to %s() was cancelled.\n", fName.c_str());
+				_executionCancelled = true;
+				_inputFailed = true;
+				return false;
+			}
+			// The statement of an input with inline assembly is run by MCJIT.
+			FunctionCall call(_engine.get(), F, _flushDenormals);
+			if (asmEngine)
+				call = FunctionCall(asmEngine, asmModule->getFunction(fName.c_str()), _flushDenormals);
+			if (_backgroundJob) {
+				_backgroundJob->calls.push_back(call);
+				_backgroundJob->types.push_back(retType);
+				if (_executionListener)
+					_executionListener->didExecute(fName);
+				return true;
+			}
 			if (_debugMode)
 				oprintf(_err, "Calling function %s()...\n", fName.c_str());
-			llvm::GenericValue result = _engine->runFunction(F, params);
+			bool completed;
+			{
+				ScopedPhase phase(&_profiler, Profiler::Execute);
+				completed = getExecutor()->run(FunctionCall::runStatement, &call);
+			}
+			if (_executionListener)
+				_executionListener->didExecute(fName);
+			if (!completed) {
+				// What was declared is kept, but the rest of the input is not run.
+				int signo = getExecutor()->stopSignal();
+				if (signo == SIGINT)
+					oprintf(_err, "Interrupted.\n");
+				else
+					oprintf(_err, "Error: The statement was stopped by %s.\n", signalName(signo));
+				_executionCancelled = true;
+				return true;
+			}
 			if (!retType.isNull() && retType.getTypePtr())
-				printGV(F, result, retType);
+				printGV(F, call.result, retType);
 		} else {
 			if (_debugMode)
 				oprintf(_err, "Code generation done; function call not needed.\n");
@@ -26,12 +26,16 @@
 #include <clang/Basic/LangOptions.h>
 #include <clang/Basic/TargetOptions.h>
 
+#include "Profiler.h"
+
 namespace llvm {
 	struct GenericValue;
 	class ExecutionEngine;
 	class Function;
 	class Linker;
 	class Module;
+	class TargetMachine;
+	class TargetOptions;
 } // namespace llvm
 
 namespace clang {
@@ -48,7 +52,10 @@ namespace ccons {
 
 class Parser;
 class DiagnosticsProvider;
+class Executor;
+class JITCodeListener;
 class MacroDetector;
+class SlabMemoryManager;
 
 //
 // IConsole interface
@@ -71,9 +78,34 @@ public:
 
 };
 
+//
+// ExecutionListener is notified by Console right before it runs the code
+// generated for a statement, and once it has run.
+//
+
+class ExecutionListener {
+
+public:
+
+	virtual ~ExecutionListener() {}
+
+	// Returns false if the statement should not be run after all, in which
+	// case the rest of the input is abandoned.
+	virtual bool willExecute(const std::string& fName) = 0;
+
+	// Called once the statement has run, been stopped, or been handed to a
+	// background job, if willExecute() returned true.
+	virtual void didExecute(const std::string& fName) {}
+
+};
+
 //
 // Console implementation
 //
+// Each Console has its own LLVMContext, parser, diagnostics and output
+// streams, so separate instances may be used concurrently from different
+// threads, provided llvm_start_multithreaded() was called beforehand.
+//
 
 class Console : public IConsole {
 
@@ -88,6 +120,75 @@ public:
 	const char * input() const;
 	void process(const char *line);
 
+	// Print a one-line timing breakdown after every input.
+	void setPrintTimings(bool printTimings);
+
+	// Append Chrome trace-event spans for every input to the specified file.
+	// Returns false if the file could not be opened.
+	bool setTraceFile(const std::string& path);
+
+	// Parse the prelude and create the execution engine ahead of time, so
+	// that the first input does not pay for the initialization.
+	void warmUp();
+
+	// The outcome of the last line passed to process().
+	enum InputStatus {
+		InputCompleted,  // an input was processed without errors
+		InputFailed,     // an input was ignored due to errors
+		InputIncomplete, // more lines are needed to complete the input
+		InputQuery,      // a command that does not change any state
+	};
+
+	InputStatus lastInputStatus() const;
+
+	// When disabled, statements are compiled but not run, which is useful
+	// to restore the declarations of a session without its side effects.
+	void setExecutionEnabled(bool enabled);
+
+	// Set the listener that is notified before statements are run. It is
+	// not owned by the console.
+	void setExecutionListener(ExecutionListener *listener);
+
+	// Returns the address of a function or global variable that was defined
+	// by earlier input, compiling it if necessary, or NULL if there is none.
+	void * lookupSymbol(const char *name);
+
+	// Set the stack size of the thread that statements are run on. A size
+	// of 0 runs them on the calling thread. Takes effect before the first
+	// statement is run.
+	void setStackSize(size_t stackSize);
+
+	// Back the slabs that the JIT allocates code and global variables from
+	// with transparent huge pages, where available. Takes effect before the
+	// first statement is compiled.
+	void setHugePages(bool hugePages);
+
+	// How the JIT compiles functions: lazily, on their first call, through
+	// stubs that get patched at that point; eagerly, along with everything
+	// they can reach, before any of it runs; or lazily until threads are in
+	// use, and then eagerly, since stubs should not be patched while other
+	// threads may be calling through them. Stubs made while compiling
+	// lazily, which function pointers may still refer to, are compiled on
+	// their first call whatever the mode.
+	enum JITMode {
+		JITLazy,
+		JITEager,
+		JITAuto,
+	};
+
+	void setJITMode(JITMode mode);
+
+	// Parse subsequent input as the specified dialect of C: c99, gnu99 (the
+	// default), c11 or gnu11. Returns false if it is not one of those.
+	bool setLanguageStandard(const std::string& standard);
+
+	// Make SIGINT interrupt the statement being run, keeping the session.
+	void handleInterrupts();
+
+	// Make SIGSEGV, SIGBUS and SIGFPE raised by a statement abandon it,
+	// keeping the session, rather than take down the process.
+	void guardCrashes();
+
 private:
 
 	enum LineType {
@@ -98,8 +199,39 @@ private:
 
 	typedef std::pair<std::string, LineType> CodeLine;
 
+	// A statement run in the background by :bg.
+	struct Job;
+
+	// Whether floating-point multiplies and adds may be fused.
+	enum FPContraction {
+		ContractOff,   // never
+		ContractOn,    // within an expression
+		ContractFast,  // wherever possible
+	};
+
 	void reportInputError();
 
+	bool handleConsoleCommand(const char *line, bool *changedState);
+	void handleStatsCommand(const char *arg);
+	void handleLayoutCommand(const char *arg);
+	void handleIRCommand(const char *arg);
+	void handleAsmCommand(const char *arg);
+	void handleSweepCommand(const char *arg);
+	void handleExecCommand(const char *arg);
+	void handleBgCommand(const char *arg);
+	void handleJobsCommand(const char *arg);
+	void handleWaitCommand(const char *arg);
+	void handleThreadsCommand(const char *arg);
+	void handleJITCommand(const char *arg);
+	void handleStdCommand(const char *arg);
+	void handleFPModeCommand(const char *arg);
+
+	llvm::Function * findDefinedFunction(const char *name);
+
+	void processInput(const char *line);
+	void updateCounters();
+	size_t getASTMemory() const;
+
 	bool shouldPrintCString(const char *p);
 	void printGV(const llvm::Function *F,
 	             const llvm::GenericValue& GV,
@@ -127,21 +259,53 @@ private:
 	clang::Stmt * locateStmt(const std::string& line,
 	                         std::string *src);
 
+	llvm::ExecutionEngine * getExecutionEngine();
+	llvm::TargetOptions getTargetOptions() const;
+	void applyFPMode();
+	void compileFunction(llvm::Function *F);
+	bool usesThreads() const;
+	void startCompilingEagerly();
+	void compileStubbedCode();
+	Executor * getExecutor();
+
 	bool compileLinkAndRun(const std::string& src,
                          const std::string& fName,
                          const clang::QualType& retType);
 
 	bool _debugMode;
+	bool _printTimings;
+	bool _executionEnabled;
+	ExecutionListener *_executionListener;
+	bool _executionCancelled;
+	bool _inputFailed;
+	InputStatus _lastInputStatus;
 	std::ostream& _out;
 	std::ostream& _err;
 	mutable llvm::raw_os_ostream _raw_err;
 	clang::LangOptions _options;
+	std::string _standard;
 	clang::TargetOptions _targetOptions;
 	llvm::OwningPtr<Parser> _parser;
 	llvm::LLVMContext _context;
 	llvm::OwningPtr<llvm::Module> _linkerModule;
 	llvm::OwningPtr<llvm::Linker> _linker;
+	llvm::OwningPtr<JITCodeListener> _codeListener;
 	llvm::OwningPtr<llvm::ExecutionEngine> _engine;
+	std::vector<llvm::ExecutionEngine*> _asmEngines;
+	llvm::TargetMachine *_targetMachine;  // owned by _engine
+	SlabMemoryManager *_memoryManager;    // owned by _engine
+	bool _hugePages;
+	JITMode _jitMode;
+	bool _compilingEagerly;
+	bool _stubsLeft;  // code compiled lazily may still call into the JIT
+	bool _fastMath;
+	FPContraction _fpContract;
+	bool _flushDenormals;
+	size_t _stackSize;
+	llvm::OwningPtr<Executor> _executor;
+	std::vector<Job*> _jobs;
+	Job *_backgroundJob;
+	unsigned _jobNo;
 	llvm::OwningPtr<DiagnosticsProvider> _dp;
 	MacroDetector *_macros;
 	std::vector<std::string> _prevMacros;
@@ -151,6 +315,7 @@ private:
 	std::string _input;
 	unsigned _funcNo;
 	FILE *_tempFile;
+	Profiler _profiler;
 
 };
 
@@ -0,0 +1,149 @@
+//
+// Disassembles machine code emitted by the JIT using the MC disassembler,
+// annotating it with basic block boundaries.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "Disassembler.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/MC/MCAsmInfo.h>
+#include <llvm/MC/MCDisassembler.h>
+#include <llvm/MC/MCInst.h>
+#include <llvm/MC/MCInstPrinter.h>
+#include <llvm/MC/MCInstrAnalysis.h>
+#include <llvm/MC/MCInstrInfo.h>
+#include <llvm/MC/MCRegisterInfo.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/Support/StringRefMemoryObject.h>
+#include <llvm/Support/TargetRegistry.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "StringUtils.h"
+
+using std::string;
+
+namespace ccons {
+
+namespace {
+
+struct DecodedInst {
+	uint64_t address;
+	uint64_t size;
+	llvm::MCInst inst;
+	bool valid;
+};
+
+} // anon namespace
+
+bool disassemble(std::ostream& out,
+                 const string& triple,
+                 const string& cpu,
+                 const uint8_t *code,
+                 size_t size,
+                 string *error)
+{
+	const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, *error);
+	if (!target)
+		return false;
+
+	llvm::OwningPtr<const llvm::MCRegisterInfo> MRI(target->createMCRegInfo(triple));
+	llvm::OwningPtr<const llvm::MCAsmInfo> MAI(MRI ? target->createMCAsmInfo(*MRI, triple) : NULL);
+	llvm::OwningPtr<const llvm::MCSubtargetInfo> STI(target->createMCSubtargetInfo(triple, cpu, ""));
+	llvm::OwningPtr<const llvm::MCInstrInfo> MII(target->createMCInstrInfo());
+	if (!MAI || !STI || !MII) {
+		*error = "No MC support for target " + triple;
+		return false;
+	}
+	llvm::OwningPtr<const llvm::MCDisassembler> disasm(target->createMCDisassembler(*STI));
+	llvm::OwningPtr<llvm::MCInstPrinter> printer(
+		target->createMCInstPrinter(MAI->getAssemblerDialect(), *MAI, *MII, *MRI, *STI));
+	if (!disasm || !printer) {
+		*error = "No disassembler for target " + triple;
+		return false;
+	}
+	llvm::OwningPtr<const llvm::MCInstrAnalysis> MIA(target->createMCInstrAnalysis(MII.get()));
+
+	const uint64_t base = (uint64_t) (uintptr_t) code;
+	llvm::StringRefMemoryObject region(llvm::StringRef((const char *) code, size), base);
+
+	// Decode everything first, so basic block leaders are known up front.
+	std::vector<DecodedInst> insts;
+	std::set<uint64_t> leaders;
+	leaders.insert(base);
+	for (uint64_t address = base; address < base + size; ) {
+		DecodedInst decoded;
+		decoded.address = address;
+		decoded.valid = disasm->getInstruction(decoded.inst, decoded.size, region,
+		                                       address, llvm::nulls(), llvm::nulls())
+		                == llvm::MCDisassembler::Success;
+		if (!decoded.valid)
+			decoded.size = 1;
+		insts.push_back(decoded);
+		address += decoded.size;
+		if (decoded.valid && MIA &&
+		    (MIA->isBranch(decoded.inst) || MIA->isReturn(decoded.inst))) {
+			leaders.insert(address);
+			uint64_t target = MIA->evaluateBranch(decoded.inst, decoded.address, decoded.size);
+			if (target != (uint64_t) -1 && target >= base && target < base + size)
+				leaders.insert(target);
+		}
+	}
+
+	std::map<uint64_t, unsigned> blocks;
+	for (std::set<uint64_t>::iterator I = leaders.begin(), E = leaders.end(); I != E; ++I) {
+		if (*I < base + size) {
+			unsigned n = blocks.size();
+			blocks[*I] = n;
+		}
+	}
+
+	oprintf(out, "; %lu bytes of machine code at %p, %lu instructions, %lu basic blocks\n",
+	        (unsigned long) size, code, (unsigned long) insts.size(),
+	        (unsigned long) blocks.size());
+	for (unsigned i = 0; i < insts.size(); ++i) {
+		const DecodedInst& decoded = insts[i];
+		std::map<uint64_t, unsigned>::iterator block = blocks.find(decoded.address);
+		if (block != blocks.end())
+			oprintf(out, "BB%u:\n", block->second);
+
+		string text;
+		if (decoded.valid) {
+			llvm::raw_string_ostream os(text);
+			printer->printInst(&decoded.inst, os, "");
+			os.flush();
+		} else {
+			string_printf(&text, "\t.byte 0x%02x", code[decoded.address - base]);
+		}
+
+		string bytes;
+		for (uint64_t j = 0; j < decoded.size && j < 8; ++j) {
+			string byte;
+			string_printf(&byte, "%02x ", code[decoded.address - base + j]);
+			bytes += byte;
+		}
+		oprintf(out, "  %5lu:  %-24s%s", (unsigned long) (decoded.address - base),
+		        bytes.c_str(), text.c_str());
+
+		// Mark branch targets with the block they lead to.
+		if (decoded.valid && MIA && MIA->isBranch(decoded.inst)) {
+			uint64_t target = MIA->evaluateBranch(decoded.inst, decoded.address, decoded.size);
+			std::map<uint64_t, unsigned>::iterator T = blocks.find(target);
+			if (T != blocks.end())
+				oprintf(out, "\t; -> BB%u", T->second);
+		}
+		oprintf(out, "\n");
+	}
+
+	return true;
+}
+
+} // namespace ccons
@@ -0,0 +1,33 @@
+#ifndef CCONS_DISASSEMBLER_H
+#define CCONS_DISASSEMBLER_H
+
+//
+// Header for Disassembler.cpp, which disassembles machine code emitted by
+// the JIT using the MC disassembler.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include <stdint.h>
+
+#include <iostream>
+#include <string>
+
+namespace ccons {
+
+// Disassemble size bytes of machine code for the specified target triple,
+// annotated with the code size and basic block boundaries. Returns false
+// and sets error if no disassembler is available for the target.
+bool disassemble(std::ostream& out,
+                 const std::string& triple,
+                 const std::string& cpu,
+                 const uint8_t *code,
+                 size_t size,
+                 std::string *error);
+
+} // namespace ccons
+
+#endif // CCONS_DISASSEMBLER_H
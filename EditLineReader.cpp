@@ -19,10 +19,12 @@ namespace ccons {
 
 namespace {
 
-static EditLineReader * reader;
-
+// Each EditLine carries the reader it belongs to, so that several readers
+// can coexist.
 static const char *ccons_prompt(EditLine *e)
 {
+	EditLineReader *reader = NULL;
+	el_get(e, EL_CLIENTDATA, &reader);
 	return (reader ? reader->getPrompt() : "??? ");
 }
 
@@ -57,7 +59,7 @@ EditLineReader::EditLineReader()
 	: _history(history_init())
 	, _editLine(el_init("ccons", stdin, stdout, stderr))
 {
-	reader = this;
+	el_set(_editLine, EL_CLIENTDATA, this);
 	history(_history, &_event, H_SETSIZE, INT_MAX);
 	el_set(_editLine, EL_PROMPT, ccons_prompt);
 	el_set(_editLine, EL_EDITOR, "emacs");
@@ -0,0 +1,496 @@
+//
+// Executor runs compiled user code on a thread of its own, with a stack of
+// configurable size.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "Executor.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <sys/ucontext.h>
+#else
+#include <ucontext.h>
+#endif
+
+namespace ccons {
+
+namespace {
+
+// The executor that SIGINT is forwarded to, if any.
+Executor * volatile foreground;
+
+// The executor whose code this thread is running, if any.
+__thread Executor *current;
+
+// The trap set on this thread, if any.
+__thread Executor::Trap *trap;
+
+// Set while waitUnlessInterrupted() waits, and once SIGINT arrives.
+volatile sig_atomic_t waiting;
+volatile sig_atomic_t waitInterrupted;
+
+// The signals that guardCrashes() handles, and what they did before.
+const int crashSignals[] = { SIGSEGV, SIGBUS, SIGFPE };
+const unsigned crashSignalCount = sizeof(crashSignals) / sizeof(crashSignals[0]);
+struct sigaction previousActions[crashSignalCount];
+
+// The memory that code of the console is emitted into. Slots are claimed
+// under the mutex, and read without it by handleCrash(): end is only set
+// once start is, and cleared first.
+struct CodeRange {
+	volatile uintptr_t start;
+	volatile uintptr_t end;
+};
+const unsigned MaxCodeRanges = 4096;
+CodeRange codeRanges[MaxCodeRanges];
+pthread_mutex_t codeRangesMutex = PTHREAD_MUTEX_INITIALIZER;
+
+bool isCompiledCode(uintptr_t pc)
+{
+	for (unsigned i = 0; i < MaxCodeRanges; i++) {
+		if (codeRanges[i].start <= pc && pc < codeRanges[i].end)
+			return true;
+	}
+	return false;
+}
+
+// Returns the address of the instruction that raised a signal, or 0 where
+// it cannot be told.
+uintptr_t faultingPC(void *context)
+{
+	ucontext_t *uc = (ucontext_t *) context;
+#if defined(__APPLE__) && defined(__x86_64__)
+	return uc->uc_mcontext->__ss.__rip;
+#elif defined(__APPLE__) && defined(__i386__)
+	return uc->uc_mcontext->__ss.__eip;
+#elif defined(__linux__) && defined(__x86_64__)
+	return uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__linux__) && defined(__i386__)
+	return uc->uc_mcontext.gregs[REG_EIP];
+#else
+	(void) uc;
+	return 0;
+#endif
+}
+
+// Handlers need a stack of their own to report a stack overflow.
+const size_t AltStackSize = 64 << 10;
+
+// Gives signo the effect it had before the handlers of executors.
+void restoreAction(int signo)
+{
+	for (unsigned i = 0; i < crashSignalCount; i++) {
+		if (crashSignals[i] == signo) {
+			sigaction(signo, &previousActions[i], NULL);
+			return;
+		}
+	}
+	signal(signo, SIG_DFL);
+}
+
+// Waits on cond for at most the specified number of milliseconds.
+void timedWait(pthread_cond_t *cond, pthread_mutex_t *mutex, long ms)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	struct timespec deadline;
+	deadline.tv_sec = now.tv_sec + ms / 1000;
+	deadline.tv_nsec = now.tv_usec * 1000 + (ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(cond, mutex, &deadline);
+}
+
+} // anon namespace
+
+void * Executor::installSignalStack()
+{
+	stack_t ss;
+	if (sigaltstack(NULL, &ss) == 0 && !(ss.ss_flags & SS_DISABLE))
+		return NULL;
+	ss.ss_sp = malloc(AltStackSize);
+	ss.ss_size = AltStackSize;
+	ss.ss_flags = 0;
+	if (!ss.ss_sp || sigaltstack(&ss, NULL) != 0) {
+		free(ss.ss_sp);
+		return NULL;
+	}
+	return ss.ss_sp;
+}
+
+void Executor::removeSignalStack(void *stack)
+{
+	if (!stack)
+		return;
+	stack_t ss;
+	memset(&ss, 0, sizeof(ss));
+	ss.ss_flags = SS_DISABLE;
+	sigaltstack(&ss, NULL);
+	free(stack);
+}
+
+Executor::Executor(size_t stackSize)
+	: _stackSize(stackSize)
+	, _owner(0)
+	, _started(false)
+	, _fn(NULL)
+	, _arg(NULL)
+	, _pending(false)
+	, _done(false)
+	, _quit(false)
+	, _signal(0)
+	, _running(0)
+	, _cancelled(0)
+{
+	if (_stackSize != 0 && _stackSize < (size_t) PTHREAD_STACK_MIN)
+		_stackSize = PTHREAD_STACK_MIN;
+}
+
+Executor::~Executor()
+{
+	if (foreground == this)
+		foreground = NULL;
+	stopThread();
+}
+
+bool Executor::startThread()
+{
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_cond, NULL);
+	_pending = _done = _quit = false;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, _stackSize);
+	_started = !pthread_create(&_thread, &attr, threadMain, this);
+	pthread_attr_destroy(&attr);
+
+	if (_started) {
+		_owner = getpid();
+	} else {
+		pthread_cond_destroy(&_cond);
+		pthread_mutex_destroy(&_mutex);
+	}
+	return _started;
+}
+
+void Executor::stopThread()
+{
+	// A forked process does not have the thread of its parent.
+	if (!_started || _owner != getpid())
+		return;
+	pthread_mutex_lock(&_mutex);
+	_quit = true;
+	pthread_cond_broadcast(&_cond);
+	pthread_mutex_unlock(&_mutex);
+	pthread_join(_thread, NULL);
+	pthread_cond_destroy(&_cond);
+	pthread_mutex_destroy(&_mutex);
+	_started = false;
+}
+
+void * Executor::threadMain(void *arg)
+{
+	Executor *executor = (Executor *) arg;
+	current = executor;
+	void *altStack = installSignalStack();
+	pthread_mutex_lock(&executor->_mutex);
+	while (!executor->_quit) {
+		if (!executor->_pending) {
+			pthread_cond_wait(&executor->_cond, &executor->_mutex);
+			continue;
+		}
+		executor->_pending = false;
+		pthread_mutex_unlock(&executor->_mutex);
+		executor->execute();
+		pthread_mutex_lock(&executor->_mutex);
+		executor->_done = true;
+		pthread_cond_broadcast(&executor->_cond);
+	}
+	pthread_mutex_unlock(&executor->_mutex);
+	removeSignalStack(altStack);
+	return NULL;
+}
+
+void Executor::execute()
+{
+	_signal = 0;
+	if (sigsetjmp(_jmpBuf, 1) == 0) {
+		_running = 1;
+		_fn(_arg);
+		_running = 0;
+	} else {
+		// Unwound out of the user code by a signal handler, which recorded
+		// the signal.
+		_running = 0;
+	}
+}
+
+bool Executor::run(void (*fn)(void *), void *arg)
+{
+	if (start(fn, arg))
+		return wait();
+
+	// Without an execution thread, the code is run on this one, still
+	// guarded against signals.
+	static __thread void *altStack;
+	if (!altStack)
+		altStack = installSignalStack();
+	Executor *previous = current;
+	current = this;
+	_fn = fn;
+	_arg = arg;
+	execute();
+	current = previous;
+	return _signal == 0;
+}
+
+bool Executor::start(void (*fn)(void *), void *arg)
+{
+	// A forked process, such as a checkpoint, only has the thread that
+	// forked it, so the execution thread needs to be started again.
+	if (_started && _owner != getpid())
+		_started = false;
+	if (!_started && (_stackSize == 0 || !startThread()))
+		return false;
+
+	pthread_mutex_lock(&_mutex);
+	_fn = fn;
+	_arg = arg;
+	_pending = true;
+	_done = false;
+	pthread_cond_broadcast(&_cond);
+	pthread_mutex_unlock(&_mutex);
+	return true;
+}
+
+bool Executor::wait()
+{
+	// The thread is gone in a forked process, and so is what it was running.
+	if (_owner != getpid())
+		return false;
+	pthread_mutex_lock(&_mutex);
+	while (!_done)
+		pthread_cond_wait(&_cond, &_mutex);
+	pthread_mutex_unlock(&_mutex);
+	return _signal == 0;
+}
+
+bool Executor::waitUnlessInterrupted(bool *interrupted)
+{
+	*interrupted = false;
+	if (_owner != getpid())
+		return false;
+	waitInterrupted = 0;
+	waiting = 1;
+	pthread_mutex_lock(&_mutex);
+	// The handler of SIGINT cannot wake this thread up.
+	while (!_done && !waitInterrupted)
+		timedWait(&_cond, &_mutex, 100);
+	bool done = _done;
+	pthread_mutex_unlock(&_mutex);
+	waiting = 0;
+	if (!done) {
+		*interrupted = true;
+		return false;
+	}
+	return _signal == 0;
+}
+
+void Executor::cancel()
+{
+	if (!_started || _owner != getpid())
+		return;
+
+	// SIGINT abandons the code of a cancelled executor, even if SIGINT is
+	// not handled otherwise.
+	struct sigaction action, previous;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handleSignal;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, &previous);
+	_cancelled = 1;
+	pthread_mutex_lock(&_mutex);
+	while (!_done) {
+		if (_running)
+			pthread_kill(_thread, SIGINT);
+		timedWait(&_cond, &_mutex, 50);
+	}
+	pthread_mutex_unlock(&_mutex);
+	_cancelled = 0;
+	sigaction(SIGINT, &previous, NULL);
+}
+
+bool Executor::isBusy()
+{
+	if (_owner != getpid())
+		return false;
+	pthread_mutex_lock(&_mutex);
+	bool busy = !_done;
+	pthread_mutex_unlock(&_mutex);
+	return busy;
+}
+
+int Executor::stopSignal() const
+{
+	return _signal;
+}
+
+void Executor::interrupt()
+{
+	if (_started && _running)
+		pthread_kill(_thread, SIGINT);
+}
+
+void Executor::handleInterrupts()
+{
+	foreground = this;
+	signal(SIGINT, handleSignal);
+}
+
+void Executor::setTrap(Trap *newTrap)
+{
+	trap = newTrap;
+}
+
+bool Executor::isForeground()
+{
+	return current && current == foreground;
+}
+
+void Executor::unwind(int signo)
+{
+	if (current && current->_running) {
+		current->_signal = signo;
+		siglongjmp(current->_jmpBuf, 1);
+	}
+	restoreAction(signo);
+	raise(signo);
+}
+
+void Executor::handleSignal(int signo)
+{
+	const bool cancelled = current && current->_cancelled;
+
+	// Let a trap clean up after the code it runs, which is stopped at the
+	// next opportunity if the trap is not armed.
+	if (trap && (trap->interruptible || *trap->signal || cancelled)) {
+		if (!*trap->signal)
+			*trap->signal = signo;
+		if (trap->armed) {
+			trap->armed = 0;
+			siglongjmp(trap->jmpBuf, 1);
+		}
+		return;
+	}
+
+	// On the foreground execution thread, or one whose code is cancelled,
+	// abandon the code being run.
+	if (current && current->_running && (current == foreground || cancelled)) {
+		current->_signal = signo;
+		siglongjmp(current->_jmpBuf, 1);
+	}
+	if (cancelled)
+		return;
+
+	// Elsewhere, forward the interrupt to the execution thread.
+	Executor *executor = foreground;
+	if (executor && executor->_running) {
+		executor->interrupt();
+		return;
+	}
+	if (waiting) {
+		waitInterrupted = 1;
+		return;
+	}
+
+	signal(signo, SIG_DFL);
+	raise(signo);
+}
+
+void Executor::guardCrashes()
+{
+	static bool guarded;
+	if (guarded)
+		return;
+	guarded = true;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = handleCrash;
+	action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	sigemptyset(&action.sa_mask);
+	for (unsigned i = 0; i < crashSignalCount; i++)
+		sigaction(crashSignals[i], &action, &previousActions[i]);
+}
+
+void Executor::addCodeRange(const void *start, size_t size)
+{
+	pthread_mutex_lock(&codeRangesMutex);
+	for (unsigned i = 0; i < MaxCodeRanges; i++) {
+		if (!codeRanges[i].start) {
+			codeRanges[i].start = (uintptr_t) start;
+			codeRanges[i].end = (uintptr_t) start + size;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&codeRangesMutex);
+}
+
+void Executor::removeCodeRange(const void *start)
+{
+	pthread_mutex_lock(&codeRangesMutex);
+	for (unsigned i = 0; i < MaxCodeRanges; i++) {
+		if (codeRanges[i].start == (uintptr_t) start) {
+			codeRanges[i].end = 0;
+			codeRanges[i].start = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&codeRangesMutex);
+}
+
+void Executor::handleCrash(int signo, siginfo_t *, void *context)
+{
+	// A crash anywhere but in the code of the console, such as in the JIT
+	// compiling a function lazily or in libc, may have left a lock held or
+	// a structure half updated, so it is not recovered from. Where the
+	// faulting instruction cannot be told, every crash is.
+	uintptr_t pc = faultingPC(context);
+	if (pc && !isCompiledCode(pc)) {
+		restoreAction(signo);
+		raise(signo);
+		return;
+	}
+
+	if (trap && trap->armed) {
+		if (!*trap->signal)
+			*trap->signal = signo;
+		trap->armed = 0;
+		siglongjmp(trap->jmpBuf, 1);
+	}
+	if (current && current->_running) {
+		current->_signal = signo;
+		siglongjmp(current->_jmpBuf, 1);
+	}
+
+	// The crash is not in user code, so let it have its previous effect,
+	// once this handler returns.
+	restoreAction(signo);
+	raise(signo);
+}
+
+} // namespace ccons
@@ -0,0 +1,143 @@
+#ifndef CCONS_EXECUTOR_H
+#define CCONS_EXECUTOR_H
+
+//
+// Executor runs compiled user code on a thread of its own, with a stack of
+// configurable size, so that the code can be interrupted by SIGINT without
+// taking down the console, and so that deep recursion or large local arrays
+// do not exhaust the stack of the console itself. It can also guard against
+// crashes in the code, abandoning it instead of taking down the process.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include <stddef.h>
+
+namespace ccons {
+
+class Executor {
+
+public:
+
+	// A stack size of 0 runs code directly on the calling thread, in which
+	// case it cannot be interrupted.
+	explicit Executor(size_t stackSize);
+	~Executor();
+
+	// Runs fn(arg) on the execution thread and waits for it to finish.
+	// Returns false if it was interrupted or crashed.
+	bool run(void (*fn)(void *), void *arg);
+
+	// Starts running fn(arg) on the execution thread without waiting for
+	// it. Returns false if there is no execution thread to run it on.
+	bool start(void (*fn)(void *), void *arg);
+
+	// Waits for the code passed to start() to finish. Returns false if it
+	// was interrupted or crashed.
+	bool wait();
+
+	// Like wait(), but if SIGINT arrives first, gives up waiting and sets
+	// interrupted, leaving the code running. Only executors whose code is
+	// not interrupted by SIGINT are waited for this way.
+	bool waitUnlessInterrupted(bool *interrupted);
+
+	// Abandons the code passed to start(), if it is still running, and
+	// waits for it to stop.
+	void cancel();
+
+	// Returns true while the code passed to start() has not finished.
+	bool isBusy();
+
+	// Returns the signal that stopped the code that was run last, or 0 if
+	// it was not stopped by a signal.
+	int stopSignal() const;
+
+	// Interrupts the code being run, if any. Safe to call from a signal
+	// handler.
+	void interrupt();
+
+	// Makes SIGINT interrupt the code run by this executor. When no code is
+	// running, SIGINT has its default effect. Other executors, such as those
+	// of background jobs, are not interrupted.
+	void handleInterrupts();
+
+	// Makes SIGSEGV, SIGBUS and SIGFPE raised by the code run by any
+	// executor abandon that code, rather than take down the process. These
+	// signals have their previous effect everywhere else, including in the
+	// libraries and the JIT that the code calls into.
+	static void guardCrashes();
+
+	// Registers and unregisters memory that the code of the console is
+	// emitted into. Only crashes in such code are guarded against.
+	static void addCodeRange(const void *start, size_t size);
+	static void removeCodeRange(const void *start);
+
+	// A trap lets code that runs user code on behalf of an executor, such
+	// as the thread pool, clean up before that code is abandoned. While a
+	// trap is set on a thread, a crash in the code run under it, or an
+	// interrupt meant for that code, is recorded in *signal instead, and
+	// unwinds to jmpBuf if armed is set. Once a signal has been recorded,
+	// SIGINT only stops the code run under the trap.
+	struct Trap {
+		sigjmp_buf jmpBuf;
+		volatile sig_atomic_t armed;
+		volatile sig_atomic_t interruptible;
+		volatile sig_atomic_t *signal;
+	};
+
+	// Sets the trap of the calling thread, or clears it if trap is NULL.
+	static void setTrap(Trap *trap);
+
+	// Returns true if the calling thread runs the code of the executor that
+	// SIGINT interrupts.
+	static bool isForeground();
+
+	// Abandons the code that the calling thread runs for its executor, as
+	// if it had been stopped by signo. Called once a trap has cleaned up.
+	static void unwind(int signo);
+
+	// Gives the calling thread a stack of its own for signal handlers, so
+	// that a stack overflow can be reported. Returns the stack to pass to
+	// removeSignalStack() before the thread exits.
+	static void * installSignalStack();
+	static void removeSignalStack(void *stack);
+
+private:
+
+	static void * threadMain(void *arg);
+	static void handleSignal(int signo);
+	static void handleCrash(int signo, siginfo_t *info, void *context);
+
+	bool startThread();
+	void stopThread();
+	void execute();
+
+	size_t _stackSize;
+	pid_t _owner;
+	bool _started;
+	pthread_t _thread;
+	pthread_mutex_t _mutex;
+	pthread_cond_t _cond;
+	void (*_fn)(void *);
+	void *_arg;
+	bool _pending;
+	bool _done;
+	bool _quit;
+	volatile sig_atomic_t _signal;
+	volatile sig_atomic_t _running;
+	volatile sig_atomic_t _cancelled;
+	sigjmp_buf _jmpBuf;
+
+};
+
+} // namespace ccons
+
+#endif // CCONS_EXECUTOR_H
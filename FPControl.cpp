@@ -0,0 +1,54 @@
+//
+// Functions to control the floating-point environment of threads that run
+// user code.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "FPControl.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+namespace ccons {
+
+#ifdef __SSE__
+
+namespace {
+
+const unsigned FlushToZero = 0x8000;
+const unsigned DenormalsAreZero = 0x0040;
+
+} // anon namespace
+
+bool DenormalsFlushed()
+{
+	return (_mm_getcsr() & (FlushToZero | DenormalsAreZero)) != 0;
+}
+
+void SetDenormalsFlushed(bool flush)
+{
+	unsigned csr = _mm_getcsr() & ~(FlushToZero | DenormalsAreZero);
+	if (flush)
+		csr |= FlushToZero | DenormalsAreZero;
+	_mm_setcsr(csr);
+}
+
+#else
+
+bool DenormalsFlushed()
+{
+	return false;
+}
+
+void SetDenormalsFlushed(bool flush)
+{
+}
+
+#endif
+
+} // namespace ccons
@@ -0,0 +1,26 @@
+#ifndef CCONS_FP_CONTROL_H
+#define CCONS_FP_CONTROL_H
+
+//
+// Functions to control the floating-point environment of threads that run
+// user code, used by the :fpmode command.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+namespace ccons {
+
+// Returns true if the calling thread flushes denormal results to zero and
+// treats denormal operands as zero (the FTZ and DAZ bits of MXCSR).
+bool DenormalsFlushed();
+
+// Sets whether the calling thread flushes denormals to zero. Does nothing
+// on targets without SSE.
+void SetDenormalsFlushed(bool flush);
+
+} // namespace ccons
+
+#endif // CCONS_FP_CONTROL_H
@@ -0,0 +1,183 @@
+//
+// Compiles the code of inputs that contain inline assembly, which the JIT
+// cannot emit, with MCJIT.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "InlineAsm.h"
+#include "Executor.h"
+
+#include <pthread.h>
+
+#include <vector>
+
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+namespace {
+
+// Resolves the symbols that code compiled by MCJIT refers to: the functions
+// and global variables of the session come from the JIT, and anything else
+// from the process and the libraries it loaded. The code sections are
+// registered with the Executor, so that crashes in them are recovered from.
+class SessionMemoryManager : public llvm::SectionMemoryManager {
+
+public:
+
+	SessionMemoryManager(llvm::ExecutionEngine *engine, llvm::Module *linked)
+		: _engine(engine), _linked(linked) {}
+
+	~SessionMemoryManager()
+	{
+		for (unsigned i = 0; i < _code.size(); i++)
+			ccons::Executor::removeCodeRange(_code[i]);
+	}
+
+	uint8_t * allocateCodeSection(uintptr_t size, unsigned alignment,
+	                              unsigned sectionID)
+	{
+		uint8_t *code = llvm::SectionMemoryManager::allocateCodeSection(size, alignment, sectionID);
+		if (code) {
+			ccons::Executor::addCodeRange(code, size);
+			_code.push_back(code);
+		}
+		return code;
+	}
+
+	void * getPointerToNamedFunction(const std::string& name,
+	                                 bool abortOnFailure = true)
+	{
+		std::string symbol = name;
+#ifdef __APPLE__
+		if (!symbol.empty() && symbol[0] == '_')
+			symbol.erase(0, 1);
+#endif
+		if (llvm::GlobalValue *GV = _linked->getNamedValue(symbol)) {
+			if (!GV->isDeclaration())
+				return _engine->getPointerToGlobal(GV);
+			// A function defined by an earlier input with inline assembly.
+			if (void *addr = _engine->getPointerToGlobalIfAvailable(GV))
+				return addr;
+		}
+		return llvm::SectionMemoryManager::getPointerToNamedFunction(name, abortOnFailure);
+	}
+
+private:
+
+	llvm::ExecutionEngine *_engine;
+	llvm::Module *_linked;
+	std::vector<uint8_t*> _code;
+
+};
+
+// Unlike the JIT, MCJIT goes through the assembly printer, which in turn
+// needs the assembly parser for inline assembly.
+void initializeTargets()
+{
+	llvm::InitializeNativeTargetAsmPrinter();
+	llvm::InitializeNativeTargetAsmParser();
+}
+
+pthread_once_t targetsOnce = PTHREAD_ONCE_INIT;
+
+} // anon namespace
+
+namespace ccons {
+
+bool UsesInlineAsm(const llvm::Module *module)
+{
+	if (!module->getModuleInlineAsm().empty())
+		return true;
+	for (llvm::Module::const_iterator F = module->begin(), FE = module->end(); F != FE; ++F) {
+		for (llvm::Function::const_iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+			for (llvm::BasicBlock::const_iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+				const llvm::CallInst *CI = llvm::dyn_cast<llvm::CallInst>(I);
+				if (CI && llvm::isa<llvm::InlineAsm>(CI->getCalledValue()))
+					return true;
+			}
+		}
+	}
+	return false;
+}
+
+llvm::Module * SplitInlineAsm(llvm::Module *module)
+{
+	llvm::Module *copy = llvm::CloneModule(module);
+
+	module->setModuleInlineAsm("");
+	for (llvm::Module::iterator F = module->begin(), E = module->end(); F != E; ++F) {
+		if (!F->isDeclaration() && !F->hasLocalLinkage())
+			F->deleteBody();
+	}
+	// Internal functions were only called by the functions above.
+	bool erased = true;
+	while (erased) {
+		erased = false;
+		for (llvm::Module::iterator I = module->begin(), E = module->end(); I != E; ) {
+			llvm::Function *F = I++;
+			if (F->hasLocalLinkage() && F->use_empty()) {
+				F->eraseFromParent();
+				erased = true;
+			}
+		}
+	}
+
+	// Internal globals, such as string literals, are not shared, so the
+	// copy keeps its own.
+	for (llvm::Module::global_iterator GV = copy->global_begin(), E = copy->global_end();
+	     GV != E; ++GV) {
+		if (!GV->isDeclaration() && !GV->hasLocalLinkage()) {
+			GV->setInitializer(NULL);
+			GV->setLinkage(llvm::GlobalValue::ExternalLinkage);
+		}
+	}
+	return copy;
+}
+
+llvm::ExecutionEngine * CompileInlineAsm(llvm::Module *module,
+                                         llvm::ExecutionEngine *engine,
+                                         llvm::Module *linked,
+                                         const llvm::TargetOptions& options,
+                                         std::string *error)
+{
+	pthread_once(&targetsOnce, initializeTargets);
+
+	llvm::OwningPtr<SessionMemoryManager> memoryManager(new SessionMemoryManager(engine, linked));
+	llvm::EngineBuilder builder(module);
+	builder.setEngineKind(llvm::EngineKind::JIT);
+	builder.setUseMCJIT(true);
+	builder.setTargetOptions(options);
+	builder.setMCJITMemoryManager(memoryManager.get());
+	builder.setErrorStr(error);
+	llvm::ExecutionEngine *asmEngine = builder.create();
+	if (!asmEngine) {
+		delete module;
+		return NULL;
+	}
+	memoryManager.take();
+	asmEngine->finalizeObject();
+
+	for (llvm::Module::iterator F = module->begin(), E = module->end(); F != E; ++F) {
+		if (F->isDeclaration() || F->hasLocalLinkage())
+			continue;
+		if (llvm::Function *declaration = linked->getFunction(F->getName()))
+			engine->updateGlobalMapping(declaration, asmEngine->getPointerToFunction(F));
+	}
+	return asmEngine;
+}
+
+} // namespace ccons
@@ -0,0 +1,50 @@
+#ifndef CCONS_INLINE_ASM_H
+#define CCONS_INLINE_ASM_H
+
+//
+// The JIT cannot emit inline assembly, so the code of an input that contains
+// any is compiled by MCJIT instead, in a separate module. Only declarations
+// of its functions are linked with the rest of the session; they are mapped
+// to the code MCJIT emitted, while its global variables stay with the JIT.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include <string>
+
+namespace llvm {
+	class ExecutionEngine;
+	class Module;
+	class TargetOptions;
+} // namespace llvm
+
+namespace ccons {
+
+// Returns true if the specified module contains inline assembly, either in
+// a function or at module level.
+bool UsesInlineAsm(const llvm::Module *module);
+
+// Returns a copy of the specified module for CompileInlineAsm(), leaving
+// only declarations of the functions it defines (other than internal ones,
+// which nothing refers to any longer) in the original. The copy in turn
+// only declares the global variables that the original defines.
+llvm::Module * SplitInlineAsm(llvm::Module *module);
+
+// Compiles a module returned by SplitInlineAsm() with MCJIT and the
+// specified options, once the original was linked into linked, which
+// engine runs. References to other code and data are resolved through
+// engine, and engine is made to call the code MCJIT emitted for the
+// functions. Returns the new engine, which owns the module, or NULL with
+// error set if it could not be compiled.
+llvm::ExecutionEngine * CompileInlineAsm(llvm::Module *module,
+                                         llvm::ExecutionEngine *engine,
+                                         llvm::Module *linked,
+                                         const llvm::TargetOptions& options,
+                                         std::string *error);
+
+} // namespace ccons
+
+#endif // CCONS_INLINE_ASM_H
@@ -23,9 +23,35 @@ static void HandleHelpCommand(const char *arg, bool debugMode,
                               std::ostream& out, std::ostream& err)
 {
 	oprintf(out, "The following commands are available:\n");
+	oprintf(out, "  :asm <function> - disassembles the JIT-compiled code of a function\n");
+	oprintf(out, "  :bg <stmt> - runs a statement in the background, as a job\n");
+	oprintf(out, "  :exec [on|off] - enables or disables running statements (they are still compiled)\n");
+	oprintf(out, "  :fpmode [fast-math=on|off] [contract=off|on|fast] [ftz=on|off] - displays or sets\n"
+	             "      the floating-point mode of the code compiled and run from then on\n");
 	oprintf(out, "  :help - displays this message\n");
+	oprintf(out, "  :ir <function> - displays the LLVM IR of a function\n");
+	oprintf(out, "  :jit [eager|lazy|auto] - displays or sets how functions are compiled; auto\n"
+	             "      compiles lazily until threads are in use\n");
+	oprintf(out, "  :jobs - lists the running and finished jobs\n");
+	oprintf(out, "  :journal [clear | exec on|off] - lists or clears the inputs replayed after a crash,\n"
+	             "      or sets whether statements are run again (multi-process mode only)\n");
+	oprintf(out, "  :layout <struct type or variable> - displays the memory layout of a struct\n");
+	oprintf(out, "  :limit [cpu=<time>] [mem=<size>] [wall=<time>] | off - limits the resources\n"
+	             "      of each evaluation, to the millisecond; mem is on top of the memory in use\n"
+	             "      (multi-process mode only)\n");
 	oprintf(out, "  :load <library path> - dynamically loads specified library\n");
+	oprintf(out, "  :rusage [on|off] - displays the resource usage of the last input, or sets whether\n"
+	             "      it is displayed after every input (multi-process mode only)\n");
+	oprintf(out, "  :sweep [--csv=<file>] <var> <start>..<end> [*factor|+step] <stmt> -\n"
+	             "      times stmt for each value of a global variable\n");
+	oprintf(out, "  :stats [reset] - displays timing and memory statistics of ccons itself\n");
+	oprintf(out, "  :std [c99|gnu99|c11|gnu11] - displays or sets the C standard that input is parsed as\n");
+	oprintf(out, "  :threads [n] - displays or sets the number of threads that run\n"
+	             "      ccons_parallel_for() and ccons_parallel_reduce() loops\n");
+	oprintf(out, "  :undo [n] - rolls back the last n statements run (multi-process mode only);\n"
+	             "      thread-local variables start over on threads other than that of statements\n");
 	oprintf(out, "  :version - displays ccons version information\n");
+	oprintf(out, "  :wait <job id> - waits for a job to finish and displays its result\n");
 }
 
 // Prints the version text.
@@ -56,38 +82,51 @@ static void HandleLoadCommand(const char *arg, bool debugMode,
 	}
 }
 
+// Returns true if the input is the internal command with the specified name,
+// in which case its arguments, stripped of surrounding whitespace, are
+// stored in args.
+bool MatchInternalCommand(const char *input, const char *name, std::string *args)
+{
+	while (isspace(*input)) input++;
+
+	if (*input != ':')
+		return false;
+
+	input++;
+	const unsigned nameLength = strlen(name);
+	if (strncmp(input, name, nameLength) ||
+	    (input[nameLength] != '\0' && !isspace(input[nameLength])))
+		return false;
+
+	int index = nameLength;
+	while (isspace(input[index])) index++;
+	int length = strlen(input + index);
+	while (length > 0 && isspace(input[index + length - 1]))
+		length--;
+	args->assign(&input[index], length);
+	return true;
+}
+
 // Handle an internal command if it was specified. If handled, returns
 // true; otherwise the input did not correspond to an internal command.
 bool HandleInternalCommand(const char *input, bool debugMode,
                            std::ostream& out, std::ostream& err)
 {
-	while (isspace(*input)) input++;
-
-	if (*input == ':') {
-		struct {
-			const char *name;
-			void (*handler)(const char *arg, bool debugMode,
-			                std::ostream& out, std::ostream& err);
-		}	commands[] = {
-			{ "help",    HandleHelpCommand    },
-			{ "version", HandleVersionCommand },
-			{ "load",    HandleLoadCommand    },
-		};
-		const unsigned commandCount = sizeof(commands)/sizeof(commands[0]);
-		input++;
-		for (unsigned i = 0; i < commandCount; i++) {
-			const unsigned nameLength = strlen(commands[i].name);
-			if (!strncmp(input, commands[i].name, nameLength) &&
-			    (input[nameLength] == '\0' || isspace(input[nameLength]))) {
-				int index = nameLength + 1;
-				while (isspace(input[index])) index++;
-				int length = strlen(input + index);
-				while (length > 0 && isspace(input[index + length - 1]))
-					length--;
-				std::string args(&input[index], length);
-				commands[i].handler(args.c_str(), debugMode, out, err);
-				return true;
-			}
+	struct {
+		const char *name;
+		void (*handler)(const char *arg, bool debugMode,
+		                std::ostream& out, std::ostream& err);
+	}	commands[] = {
+		{ "help",    HandleHelpCommand    },
+		{ "version", HandleVersionCommand },
+		{ "load",    HandleLoadCommand    },
+	};
+	const unsigned commandCount = sizeof(commands)/sizeof(commands[0]);
+	for (unsigned i = 0; i < commandCount; i++) {
+		std::string args;
+		if (MatchInternalCommand(input, commands[i].name, &args)) {
+			commands[i].handler(args.c_str(), debugMode, out, err);
+			return true;
 		}
 	}
 	return false;
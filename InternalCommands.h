@@ -12,9 +12,15 @@
 //
 
 #include <iostream>
+#include <string>
 
 namespace ccons {
 
+// Returns true if the input is the internal command with the specified name,
+// in which case its arguments, stripped of surrounding whitespace, are
+// stored in args.
+bool MatchInternalCommand(const char *input, const char *name, std::string *args);
+
 // Handle an internal command if it was specified. If handled, returns
 // true; otherwise the input did not correspond to an internal command.
 bool HandleInternalCommand(const char *input, bool debugMode,
@@ -0,0 +1,57 @@
+//
+// Implementation of JITCodeListener, which keeps track of the machine code
+// emitted by the JIT for each function.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "JITCodeListener.h"
+
+#include <llvm/IR/Function.h>
+
+namespace ccons {
+
+JITCodeListener::JITCodeListener()
+	: _totalCodeBytes(0)
+{
+}
+
+void JITCodeListener::NotifyFunctionEmitted(const llvm::Function& F,
+                                            void *code,
+                                            size_t size,
+                                            const EmittedFunctionDetails& details)
+{
+	CodeRange range;
+	range.start = code;
+	range.size = size;
+	_ranges[F.getName().str()] = range;
+	_totalCodeBytes += size;
+}
+
+void JITCodeListener::NotifyFreeingMachineCode(void *code)
+{
+	for (std::map<std::string, CodeRange>::iterator I = _ranges.begin(),
+	     E = _ranges.end(); I != E; ++I) {
+		if (I->second.start == code) {
+			_ranges.erase(I);
+			return;
+		}
+	}
+}
+
+const JITCodeListener::CodeRange *
+JITCodeListener::getCodeRange(const std::string& name) const
+{
+	std::map<std::string, CodeRange>::const_iterator I = _ranges.find(name);
+	return I == _ranges.end() ? NULL : &I->second;
+}
+
+uint64_t JITCodeListener::getTotalCodeBytes() const
+{
+	return _totalCodeBytes;
+}
+
+} // namespace ccons
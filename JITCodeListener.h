@@ -0,0 +1,56 @@
+#ifndef CCONS_JIT_CODE_LISTENER_H
+#define CCONS_JIT_CODE_LISTENER_H
+
+//
+// JITCodeListener is notified by the JIT of the machine code it emits, and
+// keeps track of where the code of each function lives and how large it is.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+#include <llvm/ExecutionEngine/JITEventListener.h>
+
+namespace ccons {
+
+class JITCodeListener : public llvm::JITEventListener {
+
+public:
+
+	struct CodeRange {
+		void *start;
+		size_t size;
+	};
+
+	JITCodeListener();
+
+	void NotifyFunctionEmitted(const llvm::Function& F,
+	                           void *code,
+	                           size_t size,
+	                           const EmittedFunctionDetails& details);
+	void NotifyFreeingMachineCode(void *code);
+
+	// Returns the code range of the named function, or NULL if the
+	// function has not been emitted.
+	const CodeRange * getCodeRange(const std::string& name) const;
+
+	// Returns the total number of bytes of machine code emitted so far.
+	uint64_t getTotalCodeBytes() const;
+
+private:
+
+	std::map<std::string, CodeRange> _ranges;
+	uint64_t _totalCodeBytes;
+
+};
+
+} // namespace ccons
+
+#endif // CCONS_JIT_CODE_LISTENER_H
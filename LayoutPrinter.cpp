@@ -0,0 +1,170 @@
+//
+// Prints the memory layout of records in the style of pahole, using the
+// layout computed by clang.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "LayoutPrinter.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <clang/AST/AST.h>
+#include <clang/AST/RecordLayout.h>
+
+#include "SrcGen.h"
+#include "StringUtils.h"
+
+using std::string;
+
+namespace ccons {
+
+namespace {
+
+struct FieldInfo {
+	string decl;
+	string name;
+	unsigned long long offsetBits;
+	unsigned long long sizeBits;
+	unsigned long long align;
+	bool isBitField;
+};
+
+// Orders fields by decreasing alignment, then by decreasing size, which
+// is the order that minimizes padding for naturally aligned fields.
+bool comparePackingOrder(const FieldInfo& a, const FieldInfo& b)
+{
+	if (a.align != b.align)
+		return a.align > b.align;
+	return a.sizeBits > b.sizeBits;
+}
+
+unsigned long long alignTo(unsigned long long value, unsigned long long align)
+{
+	return align ? (value + align - 1) / align * align : value;
+}
+
+string formatHole(unsigned long long bits)
+{
+	string str;
+	if (bits % 8)
+		string_printf(&str, "\t/* XXX %llu bits hole, try to pack */\n", bits);
+	else
+		string_printf(&str, "\t/* XXX %llu bytes hole, try to pack */\n", bits / 8);
+	return str;
+}
+
+} // anon namespace
+
+void printRecordLayout(std::ostream& out,
+                       const clang::PrintingPolicy& PP,
+                       const clang::ASTContext& context,
+                       const clang::RecordDecl *RD,
+                       unsigned cacheLineSize)
+{
+	const clang::ASTRecordLayout& layout = context.getASTRecordLayout(RD);
+	const unsigned long long size = layout.getSize().getQuantity();
+	const unsigned long long align = layout.getAlignment().getQuantity();
+
+	std::vector<FieldInfo> fields;
+	for (clang::RecordDecl::field_iterator I = RD->field_begin(), E = RD->field_end();
+	     I != E; ++I) {
+		const clang::FieldDecl *FD = *I;
+		FieldInfo info;
+		info.name = FD->getNameAsString();
+		info.decl = genVarDecl(PP, FD->getType(), info.name);
+		info.offsetBits = layout.getFieldOffset(FD->getFieldIndex());
+		info.isBitField = FD->isBitField();
+		if (info.isBitField) {
+			info.sizeBits = FD->getBitWidthValue(context);
+			info.decl += ":" + to_string(info.sizeBits);
+		} else {
+			info.sizeBits = context.getTypeSizeInChars(FD->getType()).getQuantity() * 8;
+		}
+		info.align = context.getDeclAlign(FD).getQuantity();
+		fields.push_back(info);
+	}
+
+	oprintf(out, "%s %s {\n", RD->getKindName(), RD->getNameAsString().c_str());
+	oprintf(out, "\t%-39s /* offset  size align */\n", "");
+
+	unsigned long long endBits = 0;
+	unsigned long long nextBoundary = cacheLineSize;
+	unsigned long long sumMembers = 0;
+	unsigned long long sumHoles = 0;
+	unsigned holes = 0;
+	for (unsigned i = 0; i < fields.size(); ++i) {
+		const FieldInfo& info = fields[i];
+		const unsigned long long start = info.offsetBits / 8;
+		const unsigned long long bytes = (info.sizeBits + 7) / 8;
+
+		if (!RD->isUnion() && info.offsetBits > endBits) {
+			oprintf(out, "%s", formatHole(info.offsetBits - endBits).c_str());
+			holes++;
+			sumHoles += info.offsetBits - endBits;
+		}
+		while (start >= nextBoundary) {
+			oprintf(out, "\t/* --- cacheline %llu boundary (%llu bytes) --- */\n",
+			        nextBoundary / cacheLineSize, nextBoundary);
+			nextBoundary += cacheLineSize;
+		}
+
+		string position;
+		if (info.isBitField)
+			string_printf(&position, "%llu:%llu", start, info.offsetBits % 8);
+		else
+			string_printf(&position, "%llu", start);
+		oprintf(out, "\t%-39s /* %6s %5llu %5llu */\n", (info.decl + ";").c_str(),
+		        position.c_str(), info.isBitField ? info.sizeBits : bytes, info.align);
+
+		if (bytes > 0 && bytes <= cacheLineSize &&
+		    start / cacheLineSize != (start + bytes - 1) / cacheLineSize) {
+			oprintf(out, "\t/* XXX %s straddles a cacheline boundary */\n",
+			        info.name.c_str());
+		}
+
+		sumMembers += info.sizeBits;
+		endBits = std::max(endBits, info.offsetBits + info.sizeBits);
+	}
+
+	const unsigned long long cacheLines = (size + cacheLineSize - 1) / cacheLineSize;
+	oprintf(out, "\n\t/* size: %llu, cachelines: %llu, members: %u */\n",
+	        size, cacheLines, (unsigned) fields.size());
+	if (!RD->isUnion()) {
+		oprintf(out, "\t/* sum members: %llu, holes: %u, sum holes: %llu */\n",
+		        sumMembers / 8, holes, sumHoles / 8);
+		if (size * 8 > endBits)
+			oprintf(out, "\t/* padding: %llu */\n", (size * 8 - endBits) / 8);
+	}
+	oprintf(out, "\t/* alignment: %llu */\n", align);
+
+	// Suggest an order that reduces padding. Bit-fields are left alone, since
+	// their packing depends on their neighbours.
+	bool hasBitFields = false;
+	for (unsigned i = 0; i < fields.size(); ++i)
+		hasBitFields |= fields[i].isBitField;
+	if (!RD->isUnion() && !hasBitFields && !layout.getDataSize().isZero()) {
+		std::vector<FieldInfo> sorted(fields);
+		std::stable_sort(sorted.begin(), sorted.end(), comparePackingOrder);
+		unsigned long long offset = 0;
+		for (unsigned i = 0; i < sorted.size(); ++i)
+			offset = alignTo(offset, sorted[i].align) + sorted[i].sizeBits / 8;
+		const unsigned long long packedSize = alignTo(offset, align);
+		if (packedSize < size) {
+			string order;
+			for (unsigned i = 0; i < sorted.size(); ++i)
+				order += (i ? ", " : "") + sorted[i].name;
+			oprintf(out, "\t/* suggested order saves %llu bytes (size: %llu): %s */\n",
+			        size - packedSize, packedSize, order.c_str());
+		}
+	}
+
+	oprintf(out, "};\n");
+}
+
+} // namespace ccons
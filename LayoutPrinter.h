@@ -0,0 +1,35 @@
+#ifndef CCONS_LAYOUT_PRINTER_H
+#define CCONS_LAYOUT_PRINTER_H
+
+//
+// Header for LayoutPrinter.cpp, which prints the memory layout of records
+// in the style of pahole.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include <iostream>
+
+namespace clang {
+	struct PrintingPolicy;
+	class ASTContext;
+	class RecordDecl;
+} // namespace clang
+
+namespace ccons {
+
+// Print the offset, size and alignment of each field of the specified record,
+// along with padding holes, cache line boundaries, fields that straddle cache
+// lines and, if one exists, a field order that reduces padding.
+void printRecordLayout(std::ostream& out,
+                       const clang::PrintingPolicy& PP,
+                       const clang::ASTContext& context,
+                       const clang::RecordDecl *RD,
+                       unsigned cacheLineSize = 64);
+
+} // namespace ccons
+
+#endif // CCONS_LAYOUT_PRINTER_H
@@ -0,0 +1,47 @@
+//
+// Evaluates C source with libccons, in a single session, and prints what
+// the session printed. Each argument is passed to one call of ccons_eval(),
+// and may span several lines.
+//
+// Usage: ccons-eval <source>...
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include <stdio.h>
+
+#include "libccons.h"
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <source>...\n", argv[0]);
+		return 1;
+	}
+	ccons_session *session = ccons_session_new();
+	if (!session) {
+		fprintf(stderr, "Could not create a session.\n");
+		return 1;
+	}
+
+	int failures = 0;
+	for (int i = 1; i < argc; i++) {
+		ccons_result result;
+		ccons_status status = ccons_eval(session, argv[i], &result);
+		fputs(result.output, stdout);
+		fputs(result.error, stderr);
+		fflush(stdout);
+		if (status == CCONS_ERROR) {
+			printf("[error]\n");
+			failures++;
+		} else if (status == CCONS_INCOMPLETE) {
+			printf("[incomplete]\n");
+		}
+		ccons_result_free(&result);
+	}
+	ccons_session_free(session);
+	return failures ? 1 : 0;
+}
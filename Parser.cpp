@@ -10,6 +10,8 @@
 
 #include "Parser.h"
 
+#include <unistd.h>
+
 #include <iostream>
 #include <stack>
 #include <algorithm>
@@ -31,12 +33,22 @@
 #include <clang/Sema/SemaDiagnostic.h>
 
 #include "Diagnostics.h"
+#include "Profiler.h"
 #include "SrcGen.h"
 
 using std::string;
 
 namespace ccons {
 
+// Returns the directory of the headers that ccons provides in place of
+// those that clang and the system lack: the installed one, or that of the
+// sources when ccons was not installed.
+static const char * getHeadersDir()
+{
+	if (access(CCONS_HEADERS_DIR "/stdatomic.h", R_OK) == 0)
+		return CCONS_HEADERS_DIR;
+	return CCONS_SOURCE_HEADERS_DIR;
+}
 
 //
 // ParseOperation
@@ -55,6 +67,10 @@ ParseOperation::ParseOperation(const clang::LangOptions& options,
 {
 	_target.reset(clang::TargetInfo::CreateTargetInfo(*diag, new clang::TargetOptions(*targetOptions)));
 
+	// The headers of ccons are only for C11, and are searched after those
+	// of the system, which take precedence where it has them.
+	if (options.C11)
+		_hsOptions->AddPath(getHeadersDir(), clang::frontend::After, false, false);
 	_hs.reset(new clang::HeaderSearch(_hsOptions, *_fm, *diag, options, &*_target));
 	ApplyHeaderSearchOptions(*_hs, *_hsOptions, options, llvm::Triple(targetOptions->Triple));
 	_pp.reset(new clang::Preprocessor(_ppOptions, *diag, _langOpts, &*_target, *_sm, *_hs, *this));
@@ -84,6 +100,11 @@ clang::Preprocessor * ParseOperation::getPreprocessor() const
 	return _pp.get();
 }
 
+size_t ParseOperation::getASTMemory() const
+{
+	return _ast->getASTAllocatedMemory() + _ast->getSideTableAllocatedMemory();
+}
+
 clang::SourceManager * ParseOperation::getSourceManager() const
 {
 	return _sm.get();
@@ -115,7 +136,8 @@ void ParseOperation::makeModuleVisible(clang::Module *Mod,
 Parser::Parser(const clang::LangOptions& options,
                clang::TargetOptions* targetOptions) :
 	_options(options),
-	_targetOptions(targetOptions)
+	_targetOptions(targetOptions),
+	_profiler(NULL)
 {
 }
 
@@ -124,6 +146,11 @@ Parser::~Parser()
 	releaseAccumulatedParseOperations();
 }
 
+void Parser::setProfiler(Profiler *profiler)
+{
+	_profiler = profiler;
+}
+
 void Parser::releaseAccumulatedParseOperations()
 {
 	for (std::vector<ParseOperation*>::iterator I = _ops.begin(), E = _ops.end();
@@ -133,6 +160,21 @@ void Parser::releaseAccumulatedParseOperations()
 	_ops.clear();
 }
 
+void Parser::takeAccumulatedParseOperations(std::vector<ParseOperation*> *ops)
+{
+	ops->insert(ops->end(), _ops.begin(), _ops.end());
+	_ops.clear();
+}
+
+size_t Parser::getAccumulatedASTMemory() const
+{
+	size_t bytes = 0;
+	for (std::vector<ParseOperation*>::const_iterator I = _ops.begin(), E = _ops.end();
+	     I != E; ++I) {
+		bytes += (*I)->getASTMemory();
+	}
+	return bytes;
+}
 
 ParseOperation * Parser::getLastParseOperation() const
 {
@@ -142,7 +184,8 @@ ParseOperation * Parser::getLastParseOperation() const
 Parser::InputType Parser::analyzeInput(const string& contextSource,
                                        const string& buffer,
                                        int& indentLevel,
-                                       std::vector<clang::FunctionDecl*> *fds)
+                                       std::vector<clang::FunctionDecl*> *fds,
+                                       std::vector<clang::VarDecl*> *tlsVars)
 {
 	if (buffer.length() > 1 && buffer[buffer.length() - 2] == '\\') {
 		indentLevel = 1;
@@ -150,8 +193,11 @@ Parser::InputType Parser::analyzeInput(const string& contextSource,
 	}
 
 	NullDiagnosticProvider ndp;
-	llvm::OwningPtr<ParseOperation>
-		parseOp(new ParseOperation(_options, _targetOptions, ndp.getDiagnosticsEngine()));
+	llvm::OwningPtr<ParseOperation> parseOp;
+	{
+		ScopedSpan span(_profiler, "ParseOperation");
+		parseOp.reset(new ParseOperation(_options, _targetOptions, ndp.getDiagnosticsEngine()));
+	}
 	llvm::MemoryBuffer *memBuf =
 		createMemoryBuffer(buffer, "", parseOp->getSourceManager());
 
@@ -181,8 +227,16 @@ Parser::InputType Parser::analyzeInput(const string& contextSource,
 			unsigned maxPos;
 			clang::SourceManager *sm;
 			std::vector<clang::FunctionDecl*> fds;
+			std::vector<clang::VarDecl*> tlsVars;
 			bool HandleTopLevelDecl(clang::DeclGroupRef D) {
 				for (clang::DeclGroupRef::iterator I = D.begin(), E = D.end(); I != E; ++I) {
+					if (clang::VarDecl *VD = llvm::dyn_cast<clang::VarDecl>(*I)) {
+						clang::SourceLocation Loc = sm->getExpansionLoc(VD->getLocation());
+						if (VD->getTLSKind() != clang::VarDecl::TLS_None &&
+						    sm->isFromMainFile(Loc) && sm->getFileOffset(Loc) >= pos)
+							tlsVars.push_back(VD);
+						continue;
+					}
 					if (clang::FunctionDecl *FD = llvm::dyn_cast<clang::FunctionDecl>(*I)) {
 						clang::SourceLocation Loc = FD->getTypeSpecStartLoc();
 						if (!Loc.isValid())
@@ -219,9 +273,10 @@ Parser::InputType Parser::analyzeInput(const string& contextSource,
 		ProxyDiagnosticConsumer *pdc = ndp.getProxyDiagnosticConsumer();
 		if (pdc->hadError(clang::diag::err_unterminated_block_comment))
 			return Incomplete;
-		if (!pdc->hadErrors() && (!consumer.fds.empty() || consumer.hadIncludedDecls)) {
-			if (!consumer.fds.empty())
-				fds->swap(consumer.fds);
+		if (!pdc->hadErrors() && (!consumer.fds.empty() || !consumer.tlsVars.empty() ||
+		                          consumer.hadIncludedDecls)) {
+			fds->swap(consumer.fds);
+			tlsVars->swap(consumer.tlsVars);
 			return TopLevel;
 		}
 		return Stmt;
@@ -332,6 +387,7 @@ int Parser::analyzeTokens(clang::Preprocessor& PP,
 ParseOperation * Parser::createParseOperation(clang::DiagnosticsEngine *engine,
                                               clang::PPCallbacks *callbacks)
 {
+	ScopedSpan span(_profiler, "ParseOperation");
 	return new ParseOperation(_options, _targetOptions, engine, callbacks);
 }
 
@@ -339,6 +395,7 @@ void Parser::parse(const string& src,
                    ParseOperation *parseOp,
                    clang::ASTConsumer *consumer)
 {
+	ScopedSpan span(_profiler, "Parser::parse");
 	_ops.push_back(parseOp);
 	createMemoryBuffer(src, "", parseOp->getSourceManager());
 	clang::ParseAST(*parseOp->getPreprocessor(), consumer,
@@ -36,11 +36,14 @@ namespace clang {
 	class SourceManager;
 	class TargetInfo;
 	class Token;
+	class VarDecl;
 } // namespace clang
 
 
 namespace ccons {
 
+class Profiler;
+
 //
 // ParseOperation
 // 
@@ -60,6 +63,9 @@ public:
 	clang::SourceManager * getSourceManager() const;
 	clang::TargetInfo * getTargetInfo() const;
 
+	// Returns the number of bytes allocated by the AST.
+	size_t getASTMemory() const;
+
 	virtual clang::ModuleLoadResult loadModule(clang::SourceLocation ImportLoc,
 	                                           clang::ModuleIdPath Path,
 	                                           clang::Module::NameVisibilityKind Visibility,
@@ -98,11 +104,19 @@ public:
 
 	enum InputType { Incomplete, TopLevel, Stmt }; 
 
+	// Record spans for parsing and for the construction of parse operations
+	// with the specified profiler, which may be NULL.
+	void setProfiler(Profiler *profiler);
+
   // Analyze the specified input to determine whether its complete or not.
+	// Input that defines functions, or declares thread-local variables,
+	// which cannot be declared inside of a function, is TopLevel; those
+	// declarations are returned in fds and tlsVars.
 	InputType analyzeInput(const std::string& contextSource,
 	                       const std::string& buffer,
 	                       int& indentLevel,
-	                       std::vector<clang::FunctionDecl*> *fds);
+	                       std::vector<clang::FunctionDecl*> *fds,
+	                       std::vector<clang::VarDecl*> *tlsVars);
 
 	// Create a new ParseOperation that the caller should take ownership of
 	// and the lifetime of which must be shorter than of the Parser.
@@ -125,14 +139,24 @@ public:
 	// Returns the last parse operation or NULL if there isn't one.
 	ParseOperation * getLastParseOperation() const;
 
+	// Returns the number of bytes allocated by the ASTs of the accumulated
+	// parse operations.
+	size_t getAccumulatedASTMemory() const;
+
 	// Release any accumulated parse operations (including their resulting
 	// ASTs and other clang data structures).
 	void releaseAccumulatedParseOperations();
 
+	// Transfer ownership of the accumulated parse operations to the caller,
+	// which keeps their ASTs alive. They must still be deleted before the
+	// Parser is.
+	void takeAccumulatedParseOperations(std::vector<ParseOperation*> *ops);
+
 private:
 
 	const clang::LangOptions& _options;
 	clang::TargetOptions* _targetOptions;
+	Profiler *_profiler;
 	std::vector<ParseOperation*> _ops;
 
 	int analyzeTokens(clang::Preprocessor& PP,
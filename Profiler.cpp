@@ -0,0 +1,339 @@
+//
+// Implementation of Profiler, which keeps cheap monotonic timings and memory
+// deltas for each of the phases ccons goes through when processing input.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "Profiler.h"
+
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+
+#include "StringUtils.h"
+
+using std::string;
+
+namespace ccons {
+
+namespace {
+
+string formatTime(uint64_t ns)
+{
+	string str;
+	string_printf(&str, "%.3fms", ns / 1e6);
+	return str;
+}
+
+string formatBytes(int64_t bytes, bool sign)
+{
+	string str;
+	const char *prefix = (sign && bytes >= 0) ? "+" : "";
+	int64_t magnitude = bytes < 0 ? -bytes : bytes;
+	if (magnitude >= 1024 * 1024)
+		string_printf(&str, "%s%.1fMB", prefix, bytes / (1024.0 * 1024.0));
+	else if (magnitude >= 1024)
+		string_printf(&str, "%s%.1fKB", prefix, bytes / 1024.0);
+	else
+		string_printf(&str, "%s%lldB", prefix, (long long) bytes);
+	return str;
+}
+
+string formatCounter(Profiler::Counter counter, int64_t value, bool sign)
+{
+	if (counter == Profiler::ModuleInsts) {
+		string str;
+		string_printf(&str, sign ? "%+lld" : "%lld", (long long) value);
+		return str;
+	}
+	return formatBytes(value, sign);
+}
+
+} // anon namespace
+
+//
+// Profiler
+//
+
+Profiler::Profiler()
+{
+	memset(_counters, 0, sizeof(_counters));
+	reset();
+}
+
+uint64_t Profiler::now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void Profiler::reset()
+{
+	_inputs = 0;
+	_inputSize = 0;
+	_inputStart = 0;
+	_lastTotal = 0;
+	_total = 0;
+	memset(_lastTime, 0, sizeof(_lastTime));
+	memset(_totalTime, 0, sizeof(_totalTime));
+	memset(_lastDelta, 0, sizeof(_lastDelta));
+	// Counters reflect the state of the console, so they are kept as-is.
+	memcpy(_inputCounters, _counters, sizeof(_counters));
+}
+
+void Profiler::beginInput()
+{
+	_inputStart = now();
+	memset(_lastTime, 0, sizeof(_lastTime));
+	memcpy(_inputCounters, _counters, sizeof(_counters));
+}
+
+void Profiler::endInput()
+{
+	_lastTotal = now() - _inputStart;
+	_total += _lastTotal;
+	_inputs++;
+	for (unsigned i = 0; i < NumCounters; i++)
+		_lastDelta[i] = (int64_t) (_counters[i] - _inputCounters[i]);
+	if (_trace) {
+		_trace->writeSpan("process", _inputStart, _lastTotal, _inputs, _inputSize);
+		_trace->flush();
+	}
+}
+
+void Profiler::setInputSize(size_t size)
+{
+	_inputSize = size;
+}
+
+void Profiler::enterPhase(Phase phase)
+{
+	ActivePhase active;
+	active.name = getPhaseName(phase);
+	active.phase = phase;
+	active.start = now();
+	active.nested = 0;
+	_active.push_back(active);
+}
+
+void Profiler::exitPhase()
+{
+	assert(!_active.empty() && _active.back().phase >= 0 &&
+	       "exitPhase() without enterPhase()!");
+	exitActive();
+}
+
+void Profiler::enterSpan(const char *name)
+{
+	ActivePhase active;
+	active.name = name;
+	active.phase = -1;
+	active.start = now();
+	active.nested = 0;
+	_active.push_back(active);
+}
+
+void Profiler::exitSpan()
+{
+	assert(!_active.empty() && _active.back().phase < 0 &&
+	       "exitSpan() without enterSpan()!");
+	exitActive();
+}
+
+void Profiler::exitActive()
+{
+	ActivePhase active = _active.back();
+	_active.pop_back();
+	uint64_t elapsed = now() - active.start;
+	if (_trace)
+		_trace->writeSpan(active.name, active.start, elapsed, _inputs + 1, _inputSize);
+	if (active.phase < 0) {
+		// Spans are transparent: only the phases nested in them count
+		// against the enclosing phase.
+		if (!_active.empty())
+			_active.back().nested += active.nested;
+		return;
+	}
+	uint64_t exclusive = elapsed - std::min(elapsed, active.nested);
+	_lastTime[active.phase] += exclusive;
+	_totalTime[active.phase] += exclusive;
+	if (!_active.empty())
+		_active.back().nested += elapsed;
+}
+
+bool Profiler::openTrace(const std::string& path)
+{
+	_trace.reset(new TraceWriter);
+	if (!_trace->open(path)) {
+		_trace.reset();
+		return false;
+	}
+	return true;
+}
+
+void Profiler::setCounter(Counter counter, uint64_t value)
+{
+	_counters[counter] = value;
+}
+
+void Profiler::addToCounter(Counter counter, uint64_t value)
+{
+	_counters[counter] += value;
+}
+
+void Profiler::printLastInput(std::ostream& out) const
+{
+	string line = "[timing] " + formatTime(_lastTotal) + ":";
+	for (unsigned i = 0; i < NumPhases; i++) {
+		line += i ? ", " : " ";
+		line += getPhaseName((Phase) i);
+		line += " " + formatTime(_lastTime[i]);
+	}
+	line += " |";
+	for (unsigned i = 0; i < NumCounters; i++) {
+		line += i ? ", " : " ";
+		line += getCounterName((Counter) i);
+		line += " " + formatCounter((Counter) i, _lastDelta[i], true);
+	}
+	oprintf(out, "%s\n", line.c_str());
+}
+
+void Profiler::printStats(std::ostream& out) const
+{
+	oprintf(out, "Inputs processed: %u\n", _inputs);
+	oprintf(out, "%-12s %14s %14s\n", "Phase", "Last", "Total");
+	for (unsigned i = 0; i < NumPhases; i++) {
+		oprintf(out, "%-12s %14s %14s\n", getPhaseName((Phase) i),
+		        formatTime(_lastTime[i]).c_str(),
+		        formatTime(_totalTime[i]).c_str());
+	}
+	oprintf(out, "%-12s %14s %14s\n", "total",
+	        formatTime(_lastTotal).c_str(), formatTime(_total).c_str());
+	oprintf(out, "%-12s %14s %14s\n", "Memory", "Last", "Current");
+	for (unsigned i = 0; i < NumCounters; i++) {
+		oprintf(out, "%-12s %14s %14s\n", getCounterName((Counter) i),
+		        formatCounter((Counter) i, _lastDelta[i], true).c_str(),
+		        formatCounter((Counter) i, _counters[i], false).c_str());
+	}
+}
+
+const char * Profiler::getPhaseName(Phase phase)
+{
+	switch (phase) {
+		case AnalyzeInput: return "analyze";
+		case SplitInput:   return "split";
+		case LocateStmt:   return "locate";
+		case Parse:        return "parse";
+		case CodeGen:      return "codegen";
+		case Link:         return "link";
+		case JIT:          return "jit";
+		case Execute:      return "exec";
+		default:           break;
+	}
+	return "unknown";
+}
+
+const char * Profiler::getCounterName(Counter counter)
+{
+	switch (counter) {
+		case ASTBytes:       return "ast";
+		case ModuleInsts:    return "module-insts";
+		case JITCodeBytes:   return "jit-code";
+		case JITDataBytes:   return "jit-data";
+		case JITMappedBytes: return "jit-mapped";
+		case LinesBytes:     return "lines";
+		default:           break;
+	}
+	return "unknown";
+}
+
+//
+// ScopedPhase
+//
+
+ScopedPhase::ScopedPhase(Profiler *profiler, Profiler::Phase phase)
+	: _profiler(profiler)
+{
+	_profiler->enterPhase(phase);
+}
+
+ScopedPhase::~ScopedPhase()
+{
+	_profiler->exitPhase();
+}
+
+//
+// ScopedSpan
+//
+
+ScopedSpan::ScopedSpan(Profiler *profiler, const char *name)
+	: _profiler(profiler)
+{
+	if (_profiler)
+		_profiler->enterSpan(name);
+}
+
+ScopedSpan::~ScopedSpan()
+{
+	if (_profiler)
+		_profiler->exitSpan();
+}
+
+//
+// ProfilingConsumer
+//
+
+ProfilingConsumer::ProfilingConsumer(clang::ASTConsumer *consumer,
+                                     Profiler *profiler,
+                                     Profiler::Phase phase)
+	: _consumer(consumer)
+	, _profiler(profiler)
+	, _phase(phase)
+{
+}
+
+void ProfilingConsumer::Initialize(clang::ASTContext& context)
+{
+	ScopedPhase phase(_profiler, _phase);
+	_consumer->Initialize(context);
+}
+
+bool ProfilingConsumer::HandleTopLevelDecl(clang::DeclGroupRef D)
+{
+	ScopedPhase phase(_profiler, _phase);
+	return _consumer->HandleTopLevelDecl(D);
+}
+
+void ProfilingConsumer::HandleInterestingDecl(clang::DeclGroupRef D)
+{
+	ScopedPhase phase(_profiler, _phase);
+	_consumer->HandleInterestingDecl(D);
+}
+
+void ProfilingConsumer::HandleTranslationUnit(clang::ASTContext& context)
+{
+	ScopedPhase phase(_profiler, _phase);
+	_consumer->HandleTranslationUnit(context);
+}
+
+void ProfilingConsumer::HandleTagDeclDefinition(clang::TagDecl *D)
+{
+	ScopedPhase phase(_profiler, _phase);
+	_consumer->HandleTagDeclDefinition(D);
+}
+
+void ProfilingConsumer::CompleteTentativeDefinition(clang::VarDecl *D)
+{
+	ScopedPhase phase(_profiler, _phase);
+	_consumer->CompleteTentativeDefinition(D);
+}
+
+} // namespace ccons
@@ -0,0 +1,194 @@
+#ifndef CCONS_PROFILER_H
+#define CCONS_PROFILER_H
+
+//
+// Profiler keeps cheap monotonic timings and memory deltas for each of the
+// phases ccons goes through when processing a line of input.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include <stdint.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/OwningPtr.h>
+
+#include <clang/AST/ASTConsumer.h>
+
+#include "TraceWriter.h"
+
+namespace ccons {
+
+//
+// Profiler
+//
+
+class Profiler {
+
+public:
+
+	enum Phase {
+		AnalyzeInput,
+		SplitInput,
+		LocateStmt,
+		Parse,
+		CodeGen,
+		Link,
+		JIT,
+		Execute,
+		NumPhases
+	};
+
+	enum Counter {
+		ASTBytes,
+		ModuleInsts,
+		JITCodeBytes,
+		JITDataBytes,
+		JITMappedBytes,
+		LinesBytes,
+		NumCounters
+	};
+
+	Profiler();
+
+	// Returns the value of a monotonic clock, in nanoseconds.
+	static uint64_t now();
+
+	// Mark the beginning and the end of a complete input, which may span
+	// several lines. Time spent in phases is attributed to the current input.
+	void beginInput();
+	void endInput();
+
+	// Set the size of the current input, reported with each traced span.
+	void setInputSize(size_t size);
+
+	// Enter and exit the specified phase. Phases may nest, in which case the
+	// time of the inner phase is not counted towards the outer one.
+	void enterPhase(Phase phase);
+	void exitPhase();
+
+	// Enter and exit a span that is only recorded in the trace, without
+	// affecting the phase statistics.
+	void enterSpan(const char *name);
+	void exitSpan();
+
+	// Write a Chrome trace-event span for every phase and span to the
+	// specified file. Returns false if the file could not be opened.
+	bool openTrace(const std::string& path);
+
+	// Set the current value of the specified counter. Deltas are computed
+	// relative to the value at the beginning of the current input.
+	void setCounter(Counter counter, uint64_t value);
+	void addToCounter(Counter counter, uint64_t value);
+
+	// Print a one-line breakdown of the last input.
+	void printLastInput(std::ostream& out) const;
+
+	// Print cumulative and last-input breakdowns.
+	void printStats(std::ostream& out) const;
+
+	// Clear all accumulated statistics.
+	void reset();
+
+	static const char * getPhaseName(Phase phase);
+	static const char * getCounterName(Counter counter);
+
+private:
+
+	struct ActivePhase {
+		const char *name;
+		int phase; // -1 for spans
+		uint64_t start;
+		uint64_t nested;
+	};
+
+	void exitActive();
+
+	unsigned _inputs;
+	size_t _inputSize;
+	uint64_t _inputStart;
+	uint64_t _lastTotal;
+	uint64_t _total;
+	uint64_t _lastTime[NumPhases];
+	uint64_t _totalTime[NumPhases];
+	uint64_t _counters[NumCounters];
+	uint64_t _inputCounters[NumCounters];
+	int64_t _lastDelta[NumCounters];
+	std::vector<ActivePhase> _active;
+	llvm::OwningPtr<TraceWriter> _trace;
+
+};
+
+//
+// ScopedPhase enters a phase on construction and exits it on destruction.
+//
+
+class ScopedPhase {
+
+public:
+
+	ScopedPhase(Profiler *profiler, Profiler::Phase phase);
+	~ScopedPhase();
+
+private:
+
+	Profiler *_profiler;
+
+};
+
+//
+// ScopedSpan enters a trace-only span on construction and exits it on
+// destruction. The profiler may be NULL.
+//
+
+class ScopedSpan {
+
+public:
+
+	ScopedSpan(Profiler *profiler, const char *name);
+	~ScopedSpan();
+
+private:
+
+	Profiler *_profiler;
+
+};
+
+//
+// ProfilingConsumer forwards to another ASTConsumer, attributing the time
+// spent in it to the specified phase (such as code generation during a
+// parse).
+//
+
+class ProfilingConsumer : public clang::ASTConsumer {
+
+public:
+
+	ProfilingConsumer(clang::ASTConsumer *consumer,
+	                  Profiler *profiler,
+	                  Profiler::Phase phase);
+
+	void Initialize(clang::ASTContext& context);
+	bool HandleTopLevelDecl(clang::DeclGroupRef D);
+	void HandleInterestingDecl(clang::DeclGroupRef D);
+	void HandleTranslationUnit(clang::ASTContext& context);
+	void HandleTagDeclDefinition(clang::TagDecl *D);
+	void CompleteTentativeDefinition(clang::VarDecl *D);
+
+private:
+
+	clang::ASTConsumer *_consumer;
+	Profiler *_profiler;
+	Profiler::Phase _phase;
+
+};
+
+} // namespace ccons
+
+#endif // CCONS_PROFILER_H
@@ -13,11 +13,28 @@
 
 #include "RemoteConsole.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <sstream>
-#include <signal.h>
 
-#include "popen2.h"
+#include "InternalCommands.h"
+#include "Server.h"
+#include "StringUtils.h"
+#include "spawn2.h"
 
 using std::string;
 
@@ -29,23 +46,172 @@ namespace ccons {
 
 namespace {
 
+// Both processes talk in frames, made up of a fixed-size header, followed
+// by the fields of the frame, each of which is prefixed by its length. This
+// lets arbitrarily large output be transferred in bulk, and input be passed
+// as-is, without any escaping. The parent only sends input frames.
+struct FrameHeader {
+	char magic[4];
+	uint8_t version;
+	uint8_t type;
+	uint16_t fieldCount;
+};
+
+const char kFrameMagic[4] = { 'C', 'C', 'N', 'S' };
+const uint8_t kFrameVersion = 1;
+
+// Frames beyond these limits are rejected rather than allocated for, since
+// a child that scribbled over its memory may send anything.
+const unsigned kMaxFrameFields = 16;
+const uint32_t kMaxFieldSize = 64 << 20;
+const uint64_t kMaxFrameSize = 128 << 20;
+
+enum FrameType {
+	ReplyFrame = 1,
+	OutputFrame = 2,
+	ErrorFrame = 3,
+	ReadyFrame = 4,
+	CheckpointFrame = 5,
+	InputFrame = 6,
+};
+
+// Reads exactly size bytes from fd, retrying on short reads.
+bool readFully(int fd, void *buf, size_t size)
+{
+	char *p = (char *) buf;
+	while (size > 0) {
+		ssize_t n = read(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+// Writes exactly size bytes to fd, retrying on short writes.
+bool writeFully(int fd, const void *buf, size_t size)
+{
+	const char *p = (const char *) buf;
+	while (size > 0) {
+		ssize_t n = write(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+// Returns a frame of the specified type made up of count fields.
+std::string makeFrame(FrameType type, const std::string * const *fields, unsigned count)
+{
+	FrameHeader header;
+	memcpy(header.magic, kFrameMagic, sizeof(kFrameMagic));
+	header.version = kFrameVersion;
+	header.type = type;
+	header.fieldCount = count;
+
+	size_t size = sizeof(header);
+	for (unsigned i = 0; i < count; i++)
+		size += sizeof(uint32_t) + fields[i]->size();
+
+	std::string frame;
+	frame.reserve(size);
+	frame.append((const char *) &header, sizeof(header));
+	for (unsigned i = 0; i < count; i++) {
+		uint32_t length = fields[i]->size();
+		frame.append((const char *) &length, sizeof(length));
+		frame.append(*fields[i]);
+	}
+	return frame;
+}
+
+// Writes a frame of the specified type made up of count fields, with a
+// single write.
+bool writeFrame(int fd, FrameType type, const std::string * const *fields, unsigned count)
+{
+	std::string frame = makeFrame(type, fields, count);
+	return writeFully(fd, frame.data(), frame.size());
+}
+
+// Returns the frame that passes a line of input to the child process.
+std::string makeInputFrame(const std::string& line)
+{
+	const std::string *fields[] = { &line };
+	return makeFrame(InputFrame, fields, 1);
+}
+
+// Sends a line of input to the child process through its input stream.
+bool writeInputFrame(FILE *stream, const std::string& line)
+{
+	std::string frame = makeInputFrame(line);
+	return fwrite(frame.data(), 1, frame.size(), stream) == frame.size() &&
+	       fflush(stream) == 0;
+}
+
+// Reads the next frame, returning its type and fields.
+bool readFrame(int fd, uint8_t *type, std::vector<std::string> *fields)
+{
+	FrameHeader header;
+	if (!readFully(fd, &header, sizeof(header)))
+		return false;
+	if (memcmp(header.magic, kFrameMagic, sizeof(kFrameMagic)) ||
+	    header.version != kFrameVersion)
+		return false;
+
+	if (header.fieldCount > kMaxFrameFields)
+		return false;
+
+	*type = header.type;
+	fields->resize(header.fieldCount);
+	uint64_t size = 0;
+	for (unsigned i = 0; i < header.fieldCount; i++) {
+		uint32_t length;
+		if (!readFully(fd, &length, sizeof(length)))
+			return false;
+		size += length;
+		if (length > kMaxFieldSize || size > kMaxFrameSize)
+			return false;
+		(*fields)[i].resize(length);
+		if (length && !readFully(fd, &(*fields)[i][0], length))
+			return false;
+	}
+	return true;
+}
+
 class SerializedConsoleOutput {
 
 public:
 
+	enum { FieldCount = 6 };
+
 	SerializedConsoleOutput();
 	SerializedConsoleOutput(const std::string& output,
 	                        const std::string& error,
 	                        const std::string& prompt,
-	                        const std::string& input);
+	                        const std::string& input,
+	                        Console::InputStatus status);
 
-	bool readFromStream(FILE *stream);
-	void writeToString(std::string *str) const;
+	explicit SerializedConsoleOutput(const std::vector<std::string>& fields);
+
+	void getFields(const std::string *fields[FieldCount]) const;
+	bool writeToFd(int fd) const;
 	
 	const std::string& output() const;
 	const std::string& error() const;
 	const std::string& prompt() const;
 	const std::string& input() const;
+	Console::InputStatus status() const;
+
+	// Resource usage of the child while processing the input, serialized
+	// by ResourceUsage.
+	const std::string& usage() const;
+	void setUsage(const std::string& usage);
 
 private:
 
@@ -53,91 +219,225 @@ private:
 	std::string _error;
 	std::string _prompt;
 	std::string _input;
+	std::string _status;
+	std::string _usage;
 
-	static bool readEscapedString(FILE *stream, std::string *str);
+};
 
+// ResourceUsage holds the getrusage() figures of a process, or the change
+// in them while processing an input.
+struct ResourceUsage {
+	uint64_t userUs;
+	uint64_t systemUs;
+	int64_t maxRssKB;
+	long minorFaults;
+	long majorFaults;
+	long voluntarySwitches;
+	long involuntarySwitches;
+
+	static ResourceUsage current();
+	ResourceUsage since(const ResourceUsage& start) const;
+	std::string serialize() const;
+	bool deserialize(const std::string& str);
+	std::string describe() const;
 };
 
+// Parses a duration such as "500ms", "5s", "2m" or "1h" (seconds by
+// default) into seconds.
+bool parseDuration(const std::string& str, double *seconds)
+{
+	char *end;
+	double value = strtod(str.c_str(), &end);
+	string unit(end);
+	if (end == str.c_str() || value < 0)
+		return false;
+	if (unit == "ms")
+		value /= 1000;
+	else if (unit == "m")
+		value *= 60;
+	else if (unit == "h")
+		value *= 3600;
+	else if (!unit.empty() && unit != "s")
+		return false;
+	*seconds = value;
+	return true;
+}
 
-/// UnescapeString - Modify the argument string, turning two character sequences
-/// @verbatim
-/// like '\\' 'n' into '\n'.  This handles: \e \a \b \f \n \r \t \v \' \ and
-/// \num (where num is a 1-3 byte octal value).
-/// @endverbatim
-void UnescapeString(std::string &Str) {
-  for (unsigned i = 0; i != Str.size(); ++i) {
-    if (Str[i] == '\\' && i != Str.size()-1) {
-      switch (Str[i+1]) {
-      default: continue;  // Don't execute the code after the switch.
-      case 'a': Str[i] = '\a'; break;
-      case 'b': Str[i] = '\b'; break;
-      case 'e': Str[i] = 27; break;
-      case 'f': Str[i] = '\f'; break;
-      case 'n': Str[i] = '\n'; break;
-      case 'r': Str[i] = '\r'; break;
-      case 't': Str[i] = '\t'; break;
-      case 'v': Str[i] = '\v'; break;
-      case '"': Str[i] = '\"'; break;
-      case '\'': Str[i] = '\''; break;
-      case '\\': Str[i] = '\\'; break;
-      }
-      // Nuke the second character.
-      Str.erase(Str.begin()+i+1);
-    }
-  }
-}
-
-/// EscapeString - Modify the argument string, turning '\\' and anything that
-/// doesn't satisfy std::isprint into an escape sequence.
-void EscapeString(std::string &Str) {
-  for (unsigned i = 0; i != Str.size(); ++i) {
-    if (Str[i] == '\\') {
-      ++i;
-      Str.insert(Str.begin()+i, '\\');
-    } else if (Str[i] == '\t') {
-      Str[i++] = '\\';
-      Str.insert(Str.begin()+i, 't');
-    } else if (Str[i] == '"') {
-      Str.insert(Str.begin()+i++, '\\');
-    } else if (Str[i] == '\n') {
-      Str[i++] = '\\';
-      Str.insert(Str.begin()+i, 'n');
-    } else if (!std::isprint(Str[i])) {
-      // Always expand to a 3-digit octal escape.
-      unsigned Char = Str[i];
-      Str[i++] = '\\';
-      Str.insert(Str.begin()+i++, '0'+((Char/64) & 7));
-      Str.insert(Str.begin()+i++, '0'+((Char/8)  & 7));
-      Str.insert(Str.begin()+i  , '0'+( Char     & 7));
-    }
-  }
+// Parses a size such as "64K", "512M" or "2G" (bytes by default).
+bool parseSize(const std::string& str, uint64_t *bytes)
+{
+	char *end;
+	double value = strtod(str.c_str(), &end);
+	string unit(end);
+	if (end == str.c_str() || value < 0)
+		return false;
+	if (!unit.empty() && (unit[unit.length() - 1] == 'B' || unit[unit.length() - 1] == 'b'))
+		unit.erase(unit.length() - 1);
+	if (unit == "K" || unit == "k")
+		value *= 1024.0;
+	else if (unit == "M" || unit == "m")
+		value *= 1024.0 * 1024.0;
+	else if (unit == "G" || unit == "g")
+		value *= 1024.0 * 1024.0 * 1024.0;
+	else if (unit == "T" || unit == "t")
+		value *= 1024.0 * 1024.0 * 1024.0 * 1024.0;
+	else if (!unit.empty())
+		return false;
+	*bytes = (uint64_t) value;
+	return true;
+}
+
+// Returns the size of the address space of the process, or 0 if it is not
+// known.
+uint64_t addressSpaceSize()
+{
+	FILE *statm = fopen("/proc/self/statm", "r");
+	if (!statm)
+		return 0;
+	unsigned long pages = 0;
+	if (fscanf(statm, "%lu", &pages) != 1)
+		pages = 0;
+	fclose(statm);
+	return (uint64_t) pages * sysconf(_SC_PAGESIZE);
+}
+
+string formatDuration(double seconds)
+{
+	string str;
+	if (seconds < 1)
+		string_printf(&str, "%gms", seconds * 1000);
+	else
+		string_printf(&str, "%gs", seconds);
+	return str;
+}
+
+string formatSize(uint64_t bytes)
+{
+	const char *units[] = { "", "K", "M", "G", "T" };
+	double value = bytes;
+	unsigned unit = 0;
+	while (value >= 1024 && unit < 4) {
+		value /= 1024;
+		unit++;
+	}
+	string str;
+	string_printf(&str, "%g%s", value, units[unit]);
+	return str;
 }
 
 } // anon namespace
 
+//
+// OutputForwarder redirects file descriptors 1 and 2 of the child process
+// to pipes, which a reader thread drains, forwarding everything that is
+// written to them to the parent process as soon as it arrives.
+//
+
+class OutputForwarder {
+
+public:
+
+	explicit OutputForwarder(int protocolFd);
+	~OutputForwarder();
+
+	// Redirects stdout and stderr and starts the reader thread.
+	bool start();
+
+	// Called around fork(), which only duplicates the calling thread. The
+	// forwarder of the new process is inactive until resume() is called.
+	void prepareFork();
+	void parentAfterFork();
+	void childAfterFork();
+	bool resume();
+
+	// Waits until everything written to stdout and stderr so far has been
+	// forwarded to the parent.
+	void sync();
+
+	// Sends a frame to the parent, serialized with the forwarded output.
+	bool sendFrame(FrameType type, const std::string * const *fields, unsigned count);
+
+private:
+
+	int _protocolFd;
+	int _outFd;
+	int _errFd;
+	int _wakeFds[2];
+	bool _started;
+	bool _stopping;
+	unsigned _syncsRequested;
+	unsigned _syncsDone;
+	pthread_t _thread;
+	pthread_mutex_t _sendLock;
+	pthread_mutex_t _syncLock;
+	pthread_cond_t _syncDone;
+
+	static void * threadMain(void *arg);
+	bool startThread();
+	void run();
+	void forwardAvailable(int fd, FrameType type);
+	static bool redirect(int targetFd, int *readFd);
+
+};
+
+static OutputForwarder *activeForwarder;
+static int protocolFd = STDOUT_FILENO;
+static int reviveFds[2] = { -1, -1 };
 
 //
 // C callback functions
 //
 
+// Forwards any output that is still pending, then sends the frame.
+static void sendFrame(FrameType type, const std::string * const *fields, unsigned count)
+{
+	std::cout.flush();
+	std::cerr.flush();
+	fflush(stdout);
+	fflush(stderr);
+	if (!activeForwarder) {
+		writeFrame(protocolFd, type, fields, count);
+		return;
+	}
+	activeForwarder->sync();
+	activeForwarder->sendFrame(type, fields, count);
+}
+
+static void sendReply(const SerializedConsoleOutput& sco)
+{
+	const std::string *fields[SerializedConsoleOutput::FieldCount];
+	sco.getFields(fields);
+	sendFrame(ReplyFrame, fields, SerializedConsoleOutput::FieldCount);
+}
+
 void gotsig(int signo)
 {
 	string str = strsignal(signo);
 	str += "\n";
-	SerializedConsoleOutput sco("", str, "", "");
-	sco.writeToString(&str);
-	std::cout << str;
-	std::cout.flush();
-	exit(-1);
+	sendReply(SerializedConsoleOutput("", str, "", "", Console::InputFailed));
+	// Skip goodbye(), whose reply would be read by the process that takes
+	// over from a checkpoint.
+	_exit(-1);
+}
+
+// The CPU-time limit is enforced with a profiling timer, which is finer
+// grained than RLIMIT_CPU, and reported like RLIMIT_CPU would.
+void cpuLimitExceeded(int signo)
+{
+	gotsig(SIGXCPU);
+}
+
+void revive(int signo)
+{
+	int savedErrno = errno;
+	ssize_t written = write(reviveFds[1], "", 1);
+	(void) written;
+	errno = savedErrno;
 }
 
 void goodbye(void)
 {
-	string str;
-	SerializedConsoleOutput sco("", "", "", "");
-	sco.writeToString(&str);
-	std::cout << str;
-	std::cout.flush();
+	sendReply(SerializedConsoleOutput("", "", "", "", Console::InputFailed));
 }
 
 
@@ -146,57 +446,48 @@ void goodbye(void)
 //
 
 SerializedConsoleOutput::SerializedConsoleOutput()
+	: _status(1, (char) Console::InputFailed)
 {
 }
 
 SerializedConsoleOutput::SerializedConsoleOutput(const std::string& output,
                                                  const std::string& error,
                                                  const std::string& prompt,
-                                                 const std::string& input)
+                                                 const std::string& input,
+                                                 Console::InputStatus status)
 	: _output(output)
 	, _error(error)
 	, _prompt(prompt)
 	, _input(input)
+	, _status(1, (char) status)
 {
 }
 
-bool SerializedConsoleOutput::readEscapedString(FILE *stream, std::string *str)
+SerializedConsoleOutput::SerializedConsoleOutput(const std::vector<std::string>& fields)
+	: _output(fields[0])
+	, _error(fields[1])
+	, _prompt(fields[2])
+	, _input(fields[3])
+	, _status(fields[4])
+	, _usage(fields[5])
 {
-	char buf[1024];
-	if (fgets(buf, sizeof(buf), stream)) {
-		buf[strlen(buf) - 1] = '\0';
-		*str = buf;
-		UnescapeString(*str);
-		return true;
-	}
-	return false;
 }
 
-bool SerializedConsoleOutput::readFromStream(FILE *stream)
+void SerializedConsoleOutput::getFields(const std::string *fields[FieldCount]) const
 {
-	return readEscapedString(stream, &_output) &&
-	       readEscapedString(stream, &_error) &&
-	       readEscapedString(stream, &_prompt) &&
-	       readEscapedString(stream, &_input);
+	fields[0] = &_output;
+	fields[1] = &_error;
+	fields[2] = &_prompt;
+	fields[3] = &_input;
+	fields[4] = &_status;
+	fields[5] = &_usage;
 }
 
-void SerializedConsoleOutput::writeToString(std::string *str) const
+bool SerializedConsoleOutput::writeToFd(int fd) const
 {
-	std::stringstream ss;
-	string temp;
-	temp = _output;
-	EscapeString(temp);
-	ss << temp << "\n";
-	temp = _error;
-	EscapeString(temp);
-	ss << temp << "\n";
-	temp = _prompt;
-	EscapeString(temp);
-	ss << temp << "\n";
-	temp = _input;
-	EscapeString(temp);
-	ss << temp << "\n";
-	*str = ss.str();
+	const std::string *fields[FieldCount];
+	getFields(fields);
+	return writeFrame(fd, ReplyFrame, fields, FieldCount);
 }
 
 const std::string& SerializedConsoleOutput::output() const
@@ -219,53 +510,496 @@ const std::string& SerializedConsoleOutput::input() const
 	return _input;
 }
 
+Console::InputStatus SerializedConsoleOutput::status() const
+{
+	if (_status.length() != 1)
+		return Console::InputFailed;
+	return (Console::InputStatus) _status[0];
+}
+
+const std::string& SerializedConsoleOutput::usage() const
+{
+	return _usage;
+}
+
+void SerializedConsoleOutput::setUsage(const std::string& usage)
+{
+	_usage = usage;
+}
+
+
+//
+// ResourceUsage
+//
+
+ResourceUsage ResourceUsage::current()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	ResourceUsage usage;
+	usage.userUs = ru.ru_utime.tv_sec * 1000000ull + ru.ru_utime.tv_usec;
+	usage.systemUs = ru.ru_stime.tv_sec * 1000000ull + ru.ru_stime.tv_usec;
+#ifdef __APPLE__
+	usage.maxRssKB = ru.ru_maxrss / 1024;
+#else
+	usage.maxRssKB = ru.ru_maxrss;
+#endif
+	usage.minorFaults = ru.ru_minflt;
+	usage.majorFaults = ru.ru_majflt;
+	usage.voluntarySwitches = ru.ru_nvcsw;
+	usage.involuntarySwitches = ru.ru_nivcsw;
+	return usage;
+}
+
+ResourceUsage ResourceUsage::since(const ResourceUsage& start) const
+{
+	ResourceUsage delta;
+	delta.userUs = userUs - start.userUs;
+	delta.systemUs = systemUs - start.systemUs;
+	delta.maxRssKB = maxRssKB - start.maxRssKB;
+	delta.minorFaults = minorFaults - start.minorFaults;
+	delta.majorFaults = majorFaults - start.majorFaults;
+	delta.voluntarySwitches = voluntarySwitches - start.voluntarySwitches;
+	delta.involuntarySwitches = involuntarySwitches - start.involuntarySwitches;
+	return delta;
+}
+
+std::string ResourceUsage::serialize() const
+{
+	string str;
+	string_printf(&str, "%llu %llu %lld %ld %ld %ld %ld",
+	              (unsigned long long) userUs, (unsigned long long) systemUs,
+	              (long long) maxRssKB, minorFaults, majorFaults,
+	              voluntarySwitches, involuntarySwitches);
+	return str;
+}
+
+bool ResourceUsage::deserialize(const std::string& str)
+{
+	unsigned long long user, system;
+	long long maxRss;
+	if (sscanf(str.c_str(), "%llu %llu %lld %ld %ld %ld %ld", &user, &system,
+	           &maxRss, &minorFaults, &majorFaults, &voluntarySwitches,
+	           &involuntarySwitches) != 7)
+		return false;
+	userUs = user;
+	systemUs = system;
+	maxRssKB = maxRss;
+	return true;
+}
+
+static string formatCount(long count)
+{
+	string str;
+	if (count >= 1000000)
+		string_printf(&str, "%.1fM", count / 1e6);
+	else if (count >= 10000)
+		string_printf(&str, "%.0fk", count / 1e3);
+	else
+		string_printf(&str, "%ld", count);
+	return str;
+}
+
+std::string ResourceUsage::describe() const
+{
+	string str, rss;
+	string_printf(&str, "%.1fms user, %.1fms sys, ", userUs / 1e3, systemUs / 1e3);
+	if (maxRssKB >= 1024)
+		string_printf(&rss, "+%.1fMB peak RSS, ", maxRssKB / 1024.0);
+	else
+		string_printf(&rss, "+%lldKB peak RSS, ", (long long) maxRssKB);
+	str += rss;
+	str += formatCount(minorFaults) + " minor faults, ";
+	str += formatCount(majorFaults) + " major faults, ";
+	str += formatCount(voluntarySwitches + involuntarySwitches) + " context switches";
+	if (involuntarySwitches)
+		str += " (" + formatCount(involuntarySwitches) + " involuntary)";
+	return str;
+}
+
+
+//
+// OutputForwarder
+//
+
+OutputForwarder::OutputForwarder(int protocolFd)
+	: _protocolFd(protocolFd)
+	, _outFd(-1)
+	, _errFd(-1)
+	, _started(false)
+	, _stopping(false)
+	, _syncsRequested(0)
+	, _syncsDone(0)
+{
+	_wakeFds[0] = _wakeFds[1] = -1;
+	pthread_mutex_init(&_sendLock, NULL);
+	pthread_mutex_init(&_syncLock, NULL);
+	pthread_cond_init(&_syncDone, NULL);
+}
+
+OutputForwarder::~OutputForwarder()
+{
+	if (_started) {
+		pthread_mutex_lock(&_syncLock);
+		_stopping = true;
+		pthread_mutex_unlock(&_syncLock);
+		writeFully(_wakeFds[1], "", 1);
+		pthread_join(_thread, NULL);
+	}
+	int fds[] = { _outFd, _errFd, _wakeFds[0], _wakeFds[1] };
+	for (unsigned i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+		if (fds[i] != -1)
+			close(fds[i]);
+	}
+	pthread_cond_destroy(&_syncDone);
+	pthread_mutex_destroy(&_syncLock);
+	pthread_mutex_destroy(&_sendLock);
+}
+
+bool OutputForwarder::redirect(int targetFd, int *readFd)
+{
+	int fds[2];
+	if (pipe(fds) != 0)
+		return false;
+	if (dup2(fds[1], targetFd) == -1) {
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	close(fds[1]);
+	// The reader drains whatever is available without blocking.
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	*readFd = fds[0];
+	return true;
+}
+
+bool OutputForwarder::start()
+{
+	fflush(stdout);
+	fflush(stderr);
+	if (pipe(_wakeFds) != 0)
+		return false;
+	fcntl(_wakeFds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(_wakeFds[1], F_SETFD, FD_CLOEXEC);
+	if (!redirect(STDOUT_FILENO, &_outFd) || !redirect(STDERR_FILENO, &_errFd))
+		return false;
+	// Now that stdout is a pipe, it would otherwise be fully buffered.
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	return startThread();
+}
+
+bool OutputForwarder::startThread()
+{
+	if (pthread_create(&_thread, NULL, threadMain, this) != 0)
+		return false;
+	_started = true;
+	return true;
+}
+
+void OutputForwarder::prepareFork()
+{
+	// Once synced, the reader thread is idle in poll() and holds no locks.
+	sync();
+	pthread_mutex_lock(&_sendLock);
+	pthread_mutex_lock(&_syncLock);
+}
+
+void OutputForwarder::parentAfterFork()
+{
+	pthread_mutex_unlock(&_syncLock);
+	pthread_mutex_unlock(&_sendLock);
+}
+
+void OutputForwarder::childAfterFork()
+{
+	pthread_mutex_init(&_sendLock, NULL);
+	pthread_mutex_init(&_syncLock, NULL);
+	pthread_cond_init(&_syncDone, NULL);
+	_started = false;
+}
+
+bool OutputForwarder::resume()
+{
+	// The pipes are shared with the process this one was forked from, which
+	// is gone by the time this one resumes.
+	return startThread();
+}
+
+void OutputForwarder::sync()
+{
+	if (!_started)
+		return;
+	pthread_mutex_lock(&_syncLock);
+	unsigned ticket = ++_syncsRequested;
+	pthread_mutex_unlock(&_syncLock);
+	writeFully(_wakeFds[1], "", 1);
+	pthread_mutex_lock(&_syncLock);
+	while (_syncsDone < ticket)
+		pthread_cond_wait(&_syncDone, &_syncLock);
+	pthread_mutex_unlock(&_syncLock);
+}
+
+bool OutputForwarder::sendFrame(FrameType type,
+                                const std::string * const *fields,
+                                unsigned count)
+{
+	pthread_mutex_lock(&_sendLock);
+	bool success = writeFrame(_protocolFd, type, fields, count);
+	pthread_mutex_unlock(&_sendLock);
+	return success;
+}
+
+void * OutputForwarder::threadMain(void *arg)
+{
+	// Crash signals are to be handled by the thread running user code.
+	sigset_t set;
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	static_cast<OutputForwarder *>(arg)->run();
+	return NULL;
+}
+
+void OutputForwarder::run()
+{
+	struct pollfd fds[3];
+	fds[0].fd = _outFd;
+	fds[1].fd = _errFd;
+	fds[2].fd = _wakeFds[0];
+	for (unsigned i = 0; i < 3; i++)
+		fds[i].events = POLLIN;
+
+	for (;;) {
+		if (poll(fds, 3, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[0].revents)
+			forwardAvailable(_outFd, OutputFrame);
+		if (fds[1].revents)
+			forwardAvailable(_errFd, ErrorFrame);
+		if (fds[2].revents) {
+			char c;
+			if (read(_wakeFds[0], &c, 1) != 1)
+				continue;
+			// Anything written before sync() was called is in the pipes by now.
+			forwardAvailable(_outFd, OutputFrame);
+			forwardAvailable(_errFd, ErrorFrame);
+			pthread_mutex_lock(&_syncLock);
+			bool stopping = _stopping;
+			if (_syncsDone < _syncsRequested)
+				_syncsDone++;
+			pthread_cond_broadcast(&_syncDone);
+			pthread_mutex_unlock(&_syncLock);
+			if (stopping)
+				break;
+		}
+	}
+}
+
+void OutputForwarder::forwardAvailable(int fd, FrameType type)
+{
+	std::string chunk;
+	char buf[64 * 1024];
+	for (;;) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		chunk.assign(buf, n);
+		const std::string *fields[] = { &chunk };
+		sendFrame(type, fields, 1);
+	}
+}
+
 
 //
 // RemoteConsole
 //
 
-RemoteConsole::RemoteConsole(const char * command, bool DebugMode) :
+RemoteConsole::RemoteConsole(const char * command,
+                             const std::vector<std::string>& options,
+                             bool DebugMode) :
 	_command(command),
-	_DebugMode(DebugMode)
+	_options(options),
+	_DebugMode(DebugMode),
+	_replayExecutes(true),
+	_maxCheckpoints(0),
+	_inputNo(0),
+	_cpuLimit(0),
+	_memLimit(0),
+	_wallLimit(0),
+	_deadline(0),
+	_printUsage(false)
+{
+	init();
+}
+
+RemoteConsole::RemoteConsole(const std::string& socketPath, bool DebugMode) :
+	_socketPath(socketPath),
+	_DebugMode(DebugMode),
+	_replayExecutes(true),
+	_maxCheckpoints(0),
+	_inputNo(0),
+	_cpuLimit(0),
+	_memLimit(0),
+	_wallLimit(0),
+	_deadline(0),
+	_printUsage(false)
 {
+	init();
+}
+
+void RemoteConsole::init()
+{
+	_child.pid = _spare.pid = -1;
+	_child.ostream = _spare.ostream = NULL;
+	_child.ifd = _spare.ifd = -1;
+	_child.controlFd = _spare.controlFd = -1;
 	signal(SIGCHLD, SIG_IGN);
+	// A child that died is detected by its reply, not by a fatal signal.
+	signal(SIGPIPE, SIG_IGN);
 	reset();
 }
 
 RemoteConsole::~RemoteConsole()
 {
+	discardCheckpoints();
 	cleanup();
+	closeChild(&_spare);
+}
+
+void RemoteConsole::setMaxCheckpoints(unsigned maxCheckpoints)
+{
+	_maxCheckpoints = maxCheckpoints;
+	trimCheckpoints();
 }
 
 void RemoteConsole::cleanup()
 {
-	if (_ostream) {
-		fclose(_ostream);
-		_ostream = NULL;
+	closeChild(&_child);
+}
+
+bool RemoteConsole::spawnChild(ChildProcess *child)
+{
+	if (!_socketPath.empty()) {
+		// The pid of a server worker is only known once it is ready.
+		int controlFd;
+		int fd = ConnectToServer(_socketPath, &controlFd);
+		if (fd == -1) {
+			std::cerr << "Could not connect to " << _socketPath << ": " << strerror(errno) << "\n";
+			return false;
+		}
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		fcntl(controlFd, F_SETFD, FD_CLOEXEC);
+		child->controlFd = controlFd;
+		child->pid = -1;
+		child->ostream = fdopen(dup(fd), "w");
+		setlinebuf(child->ostream);
+		child->ifd = fd;
+		return true;
 	}
-	if (_istream) {
-		fclose(_istream);
-		_istream = NULL;
+
+	std::vector<std::string> args;
+	args.push_back(_command);
+	args.push_back("--ccons-use-std-io");
+	args.push_back("--ccons-serialized-output");
+	if (_DebugMode)
+		args.push_back("--ccons-debug");
+	args.insert(args.end(), _options.begin(), _options.end());
+
+	std::vector<char *> argv;
+	for (unsigned i = 0; i < args.size(); ++i)
+		argv.push_back(const_cast<char *>(args[i].c_str()));
+	argv.push_back(NULL);
+
+	int infp, outfp;
+	child->pid = spawn2(&argv[0], &infp, &outfp);
+	if (child->pid == -1) {
+		std::cerr << "Could not start " << _command << ": " << strerror(errno) << "\n";
+		return false;
 	}
+	child->ostream = fdopen(infp, "w");
+	setlinebuf(child->ostream);
+	child->ifd = outfp;
+	child->controlFd = -1;
+	return true;
+}
+
+void RemoteConsole::closeChild(ChildProcess *child)
+{
+	// Closing the pipes makes the child see the end of its input and exit.
+	if (child->ostream) {
+		fclose(child->ostream);
+		child->ostream = NULL;
+	}
+	if (child->ifd != -1) {
+		close(child->ifd);
+		child->ifd = -1;
+	}
+	// Closing the control socket lets the keeper of a server worker exit.
+	if (child->controlFd != -1) {
+		close(child->controlFd);
+		child->controlFd = -1;
+	}
+	child->pid = -1;
 }
 
 void RemoteConsole::reset()
 {
-	// TODO: check for errors!
-	int infp, outfp;
-	std::string command_line(_command);
-	command_line += " --ccons-use-std-io --ccons-serialized-output";
-	if (_DebugMode)
-		command_line += " --ccons-debug";
-	popen2(command_line.c_str(), &infp, &outfp);
-	_ostream = fdopen(infp, "w");
-	setlinebuf(_ostream);
-	_istream = fdopen(outfp, "r");
-	setlinebuf(_istream);
+	// Checkpoints of the previous child cannot be used by the next one.
+	discardCheckpoints();
+
+	// Swap in the spare, which has normally finished initializing by now.
+	// Each child announces that it is ready once its warm-up is done.
+	std::vector<std::string> fields;
+	_child = _spare;
+	_spare.pid = -1;
+	_spare.ostream = NULL;
+	_spare.ifd = -1;
+	_spare.controlFd = -1;
+	if (_child.ifd == -1 || !readUntil(&_child, ReadyFrame, &fields)) {
+		closeChild(&_child);
+		if (spawnChild(&_child) && !readUntil(&_child, ReadyFrame, &fields))
+			closeChild(&_child);
+	}
+	// Start the next spare, which warms up while this one is in use.
+	spawnChild(&_spare);
 	_prompt = ">>> ";
 	_input = "";
 }
 
+bool RemoteConsole::readUntil(ChildProcess *child,
+                              uint8_t type,
+                              std::vector<std::string> *fields)
+{
+	if (child->ifd == -1)
+		return false;
+	// Output and errors are streamed as they are produced, until a frame of
+	// the requested type arrives.
+	uint8_t frameType;
+	while (waitForFrame(child) && readFrame(child->ifd, &frameType, fields)) {
+		if (frameType == CheckpointFrame && fields->size() == 1) {
+			addCheckpoint(atoi((*fields)[0].c_str()));
+		} else if (frameType == OutputFrame && fields->size() == 1) {
+			std::cout << (*fields)[0];
+			std::cout.flush();
+		} else if (frameType == ErrorFrame && fields->size() == 1) {
+			std::cerr << (*fields)[0];
+		} else if (frameType == type) {
+			if (type == ReadyFrame && fields->size() == 1)
+				child->pid = atoi((*fields)[0].c_str());
+			return true;
+		} else if (frameType == ReplyFrame) {
+			// An unexpected reply means the child exited prematurely.
+			return false;
+		}
+	}
+	return false;
+}
+
 const char * RemoteConsole::prompt() const
 {
 	return _prompt.c_str();
@@ -278,11 +1012,40 @@ const char * RemoteConsole::input() const
 
 void RemoteConsole::process(const char *line)
 {
-	fputs(line, _ostream);
+	string args;
+	if (_pendingInput.empty()) {
+		if (MatchInternalCommand(line, "journal", &args)) {
+			handleJournalCommand(args.c_str());
+			return;
+		}
+		if (MatchInternalCommand(line, "undo", &args)) {
+			handleUndoCommand(args.c_str());
+			return;
+		}
+		if (MatchInternalCommand(line, "limit", &args)) {
+			handleLimitCommand(args.c_str());
+			return;
+		}
+		if (MatchInternalCommand(line, "rusage", &args)) {
+			handleUsageCommand(args.c_str());
+			return;
+		}
+	}
+	_inputNo++;
 
 	SerializedConsoleOutput sco;
-	bool success = sco.readFromStream(_istream);
+	std::vector<std::string> fields;
+	bool success = false;
+	if (_child.ostream) {
+		writeInputFrame(_child.ostream, line);
+		if (_wallLimit)
+			_deadline = Profiler::now() + (uint64_t) (_wallLimit * 1e9);
+		success = readUntil(&_child, ReplyFrame, &fields) &&
+		          fields.size() == SerializedConsoleOutput::FieldCount;
+		_deadline = 0;
+	}
 	if (success) {
+		sco = SerializedConsoleOutput(fields);
 		if (sco.prompt().empty() && sco.output().empty() && sco.error().empty())
 			exit(0);
 		std::cout << sco.output();
@@ -290,14 +1053,389 @@ void RemoteConsole::process(const char *line)
 	}
 
 	if (!success || sco.prompt().empty()) {
-		cleanup();
-		reset();
-		std::cout << "\nNOTE: Interpreter restarted.\n";
+		// Roll back to the checkpoint taken right before the statement that
+		// failed, if there is one.
+		if (!_checkpoints.empty() && _checkpoints.back().inputNo == _inputNo) {
+			if (reviveCheckpoint(_checkpoints.size() - 1)) {
+				std::cout << "\nNOTE: Rolled back to the state before the failed statement.\n";
+				return;
+			}
+		}
+		restart();
+		return;
+	}
+
+	recordInput(line, sco.status());
+	ResourceUsage usage;
+	if (usage.deserialize(sco.usage())) {
+		_lastUsage = usage.describe();
+		if (_printUsage && sco.status() != Console::InputIncomplete)
+			oprintf(std::cerr, "[rusage] %s\n", _lastUsage.c_str());
+	}
+	_prompt = sco.prompt();
+	_input = sco.input();
+}
+
+bool RemoteConsole::waitForFrame(ChildProcess *child)
+{
+	// Checkpoints keep the pipe open after the child dies, so it may never
+	// see the end of the stream; check whether the child is still alive.
+	struct pollfd fds;
+	fds.fd = child->ifd;
+	fds.events = POLLIN;
+	for (;;) {
+		int timeout = 250;
+		if (_deadline && child == &_child) {
+			uint64_t now = Profiler::now();
+			if (now >= _deadline) {
+				// The watchdog stops the evaluation, which is then handled
+				// like a crash.
+				_deadline = 0;
+				signalProcess(child, child->pid, SIGKILL);
+				oprintf(std::cerr, "Wall-time limit of %s exceeded.\n",
+				        formatDuration(_wallLimit).c_str());
+				return false;
+			}
+			timeout = std::min<uint64_t>(timeout, (_deadline - now) / 1000000 + 1);
+		}
+		int n = poll(&fds, 1, timeout);
+		if (n > 0)
+			return true;
+		if (n < 0 && errno != EINTR)
+			return false;
+		if (child->pid != -1 && signalProcess(child, child->pid, 0) == -1 && errno == ESRCH)
+			return false;
+	}
+}
+
+int RemoteConsole::signalProcess(ChildProcess *child, pid_t pid, int signo)
+{
+	// The processes of a server worker, including its checkpoints, are
+	// signaled by the keeper of its session.
+	if (child->controlFd != -1)
+		return SignalSessionProcess(child->controlFd, pid, signo);
+	return kill(pid, signo);
+}
+
+void RemoteConsole::addCheckpoint(pid_t pid)
+{
+	if (pid <= 0)
 		return;
+	Checkpoint checkpoint;
+	checkpoint.pid = pid;
+	checkpoint.journalSize = _journal.size();
+	checkpoint.inputNo = _inputNo;
+	_checkpoints.push_back(checkpoint);
+	trimCheckpoints();
+}
+
+void RemoteConsole::trimCheckpoints()
+{
+	while (_checkpoints.size() > _maxCheckpoints) {
+		signalProcess(&_child, _checkpoints.front().pid, SIGKILL);
+		_checkpoints.pop_front();
 	}
+}
+
+void RemoteConsole::discardCheckpoints()
+{
+	for (unsigned i = 0; i < _checkpoints.size(); ++i)
+		signalProcess(&_child, _checkpoints[i].pid, SIGKILL);
+	_checkpoints.clear();
+}
 
+bool RemoteConsole::reviveCheckpoint(unsigned index)
+{
+	Checkpoint checkpoint = _checkpoints[index];
+	for (unsigned i = index + 1; i < _checkpoints.size(); ++i)
+		signalProcess(&_child, _checkpoints[i].pid, SIGKILL);
+	_checkpoints.erase(_checkpoints.begin() + index, _checkpoints.end());
+
+	// The revived process resumes right before it was to run a statement,
+	// skips it and replies to the input it was processing.
+	if (_child.pid != -1)
+		signalProcess(&_child, _child.pid, SIGKILL);
+	_child.pid = checkpoint.pid;
+	std::vector<std::string> fields;
+	if (signalProcess(&_child, checkpoint.pid, SIGUSR1) != 0 ||
+	    !readUntil(&_child, ReplyFrame, &fields) ||
+	    fields.size() != SerializedConsoleOutput::FieldCount)
+		return false;
+	SerializedConsoleOutput sco(fields);
+	if (sco.prompt().empty())
+		return false;
 	_prompt = sco.prompt();
 	_input = sco.input();
+	_pendingInput.clear();
+	_journal.resize(checkpoint.journalSize);
+	return true;
+}
+
+void RemoteConsole::restart()
+{
+	_pendingInput.clear();
+	// The checkpoints are signaled through the child being closed.
+	discardCheckpoints();
+	cleanup();
+	reset();
+	std::cout << "\nNOTE: Interpreter restarted.\n";
+	replayJournal();
+	sendLimits();
+}
+
+bool RemoteConsole::sendLimits()
+{
+	if (!_child.ostream)
+		return false;
+	// The child enforces the CPU-time and address-space limits itself; the
+	// CPU-time limit is passed in milliseconds.
+	std::string line;
+	string_printf(&line, ":limit cpu=%lu mem=%llu\n",
+	              (unsigned long) ceil(_cpuLimit * 1000), (unsigned long long) _memLimit);
+	std::vector<std::string> fields;
+	return writeInputFrame(_child.ostream, line) &&
+	       readUntil(&_child, ReplyFrame, &fields);
+}
+
+void RemoteConsole::setPrintUsage(bool printUsage)
+{
+	_printUsage = printUsage;
+}
+
+void RemoteConsole::handleUsageCommand(const char *arg)
+{
+	if (!strcmp(arg, "on")) {
+		setPrintUsage(true);
+	} else if (!strcmp(arg, "off")) {
+		setPrintUsage(false);
+	} else if (*arg) {
+		std::cerr << "Usage: :rusage [on|off]\n";
+		return;
+	} else if (!_lastUsage.empty()) {
+		oprintf(std::cout, "Last input: %s\n", _lastUsage.c_str());
+	}
+	oprintf(std::cout, "Resource usage is %s after every input.\n",
+	        _printUsage ? "printed" : "not printed");
+}
+
+void RemoteConsole::handleLimitCommand(const char *arg)
+{
+	double cpuLimit = _cpuLimit;
+	double wallLimit = _wallLimit;
+	uint64_t memLimit = _memLimit;
+
+	std::istringstream ss(arg);
+	string setting;
+	while (ss >> setting) {
+		size_t eq = setting.find('=');
+		string name = setting.substr(0, eq);
+		string value = eq == string::npos ? "" : setting.substr(eq + 1);
+		if (value == "none" || value == "off")
+			value = "0";
+		bool valid = false;
+		if (setting == "off") {
+			cpuLimit = wallLimit = 0;
+			memLimit = 0;
+			valid = true;
+		} else if (name == "cpu") {
+			valid = parseDuration(value, &cpuLimit);
+		} else if (name == "wall") {
+			valid = parseDuration(value, &wallLimit);
+		} else if (name == "mem") {
+			valid = parseSize(value, &memLimit);
+		}
+		if (!valid) {
+			std::cerr << "Usage: :limit [cpu=<time>] [mem=<size>] [wall=<time>] | off\n";
+			return;
+		}
+	}
+
+	_cpuLimit = cpuLimit;
+	_memLimit = memLimit;
+	_wallLimit = wallLimit;
+	if (!sendLimits()) {
+		restart();
+		return;
+	}
+
+	if (!_cpuLimit && !_memLimit && !_wallLimit) {
+		std::cout << "No limits are set.\n";
+		return;
+	}
+	string limits;
+	if (_cpuLimit)
+		limits += " cpu=" + formatDuration(ceil(_cpuLimit * 1000) / 1000);
+	if (_memLimit)
+		limits += " mem=" + formatSize(_memLimit);
+	if (_wallLimit)
+		limits += " wall=" + formatDuration(_wallLimit);
+	oprintf(std::cout, "Limits per evaluation:%s\n", limits.c_str());
+}
+
+void RemoteConsole::handleUndoCommand(const char *arg)
+{
+	unsigned count = *arg ? atoi(arg) : 1;
+	if (count == 0) {
+		std::cerr << "Usage: :undo [n]\n";
+		return;
+	}
+	if (count > _checkpoints.size()) {
+		oprintf(std::cerr, "Cannot undo %u evaluation%s; %u checkpoint%s available.\n",
+		        count, count == 1 ? "" : "s",
+		        (unsigned) _checkpoints.size(), _checkpoints.size() == 1 ? " is" : "s are");
+		return;
+	}
+	if (!reviveCheckpoint(_checkpoints.size() - count)) {
+		restart();
+		return;
+	}
+	oprintf(std::cout, "Rolled back %u evaluation%s.\n", count, count == 1 ? "" : "s");
+}
+
+void RemoteConsole::recordInput(const char *line, Console::InputStatus status)
+{
+	_pendingInput += line;
+	if (_pendingInput.empty() || _pendingInput[_pendingInput.length() - 1] != '\n')
+		_pendingInput += "\n";
+	switch (status) {
+		case Console::InputCompleted:
+			_journal.push_back(_pendingInput);
+			_pendingInput.clear();
+			break;
+		case Console::InputFailed:
+		case Console::InputQuery:
+			_pendingInput.clear();
+			break;
+		case Console::InputIncomplete:
+			break;
+	}
+}
+
+bool RemoteConsole::replayJournal()
+{
+	if (_journal.empty() || !_child.ostream)
+		return true;
+
+	uint64_t start = Profiler::now();
+	std::string data;
+	unsigned expected = 0;
+	if (_maxCheckpoints) {
+		data += makeInputFrame(":checkpoints off\n");
+		expected++;
+	}
+	if (!_replayExecutes) {
+		data += makeInputFrame(":exec off\n");
+		expected++;
+	}
+	// Journal entries may span several lines, each of which is sent in its
+	// own frame and gets its own reply.
+	for (unsigned i = 0; i < _journal.size(); ++i) {
+		const std::string& entry = _journal[i];
+		for (size_t pos = 0; pos < entry.size(); ) {
+			size_t end = entry.find('\n', pos);
+			end = (end == std::string::npos) ? entry.size() : end + 1;
+			data += makeInputFrame(entry.substr(pos, end - pos));
+			expected++;
+			pos = end;
+		}
+	}
+	if (!_replayExecutes) {
+		data += makeInputFrame(":exec on\n");
+		expected++;
+	}
+	if (_maxCheckpoints) {
+		data += makeInputFrame(":checkpoints on\n");
+		expected++;
+	}
+
+	// The inputs are written while the replies are read, so that neither
+	// process waits on the other for each input, and neither blocks on a
+	// full pipe. Output produced during the replay is discarded.
+	int fd = fileno(_child.ostream);
+	fflush(_child.ostream);
+	int flags = fcntl(fd, F_GETFL);
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+	size_t written = 0;
+	unsigned replies = 0;
+	unsigned failed = 0;
+	bool success = true;
+	std::vector<std::string> fields;
+	while (success && replies < expected) {
+		struct pollfd fds[2];
+		fds[0].fd = _child.ifd;
+		fds[0].events = POLLIN;
+		fds[1].fd = fd;
+		fds[1].events = written < data.length() ? POLLOUT : 0;
+		if (poll(fds, 2, -1) < 0) {
+			success = (errno == EINTR);
+			continue;
+		}
+		if (fds[1].revents & POLLOUT) {
+			ssize_t n = write(fd, data.data() + written, data.length() - written);
+			if (n > 0)
+				written += n;
+			else if (n < 0 && errno != EAGAIN && errno != EINTR)
+				success = false;
+		}
+		if (fds[0].revents) {
+			uint8_t type;
+			if (!readFrame(_child.ifd, &type, &fields)) {
+				success = false;
+			} else if (type == ReplyFrame) {
+				SerializedConsoleOutput sco;
+				if (fields.size() == SerializedConsoleOutput::FieldCount)
+					sco = SerializedConsoleOutput(fields);
+				if (sco.prompt().empty())
+					success = false;
+				else if (sco.status() == Console::InputFailed)
+					failed++;
+				replies++;
+			}
+		}
+	}
+	fcntl(fd, F_SETFL, flags);
+
+	if (!success) {
+		// Do not replay again into the next child, which would most likely
+		// crash the same way.
+		cleanup();
+		reset();
+		std::cout << "NOTE: Replaying the session failed; its state was not restored.\n";
+		return false;
+	}
+
+	// Every input is parsed along with the declarations of those before it,
+	// so the time per input grows with the length of the session.
+	double ms = (Profiler::now() - start) / 1e6;
+	oprintf(std::cout, "NOTE: Restored %u input%s in %.1fms (%.2fms per input)",
+	        (unsigned) _journal.size(), _journal.size() == 1 ? "" : "s",
+	        ms, ms / _journal.size());
+	if (failed)
+		oprintf(std::cout, " (%u failed)", failed);
+	oprintf(std::cout, ".\n");
+	return true;
+}
+
+void RemoteConsole::handleJournalCommand(const char *arg)
+{
+	if (!strcmp(arg, "clear")) {
+		_journal.clear();
+		std::cout << "Journal cleared.\n";
+	} else if (!strcmp(arg, "exec on")) {
+		_replayExecutes = true;
+		std::cout << "Statements will be run again when the journal is replayed.\n";
+	} else if (!strcmp(arg, "exec off")) {
+		_replayExecutes = false;
+		std::cout << "Statements will be compiled but not run when the journal is replayed.\n";
+	} else if (!*arg) {
+		for (unsigned i = 0; i < _journal.size(); ++i)
+			oprintf(std::cout, "%4u: %s", i + 1, _journal[i].c_str());
+		oprintf(std::cout, "%u input%s in the journal.\n",
+		        (unsigned) _journal.size(), _journal.size() == 1 ? "" : "s");
+	} else {
+		std::cerr << "Usage: :journal [clear | exec on | exec off]\n";
+	}
 }
 
 
@@ -305,10 +1443,11 @@ void RemoteConsole::process(const char *line)
 // SerializedOutputConsole
 //
 
-SerializedOutputConsole::SerializedOutputConsole(bool DebugMode)
-	: _console(new Console(DebugMode, _ss_out, _ss_err))
-	, _tmp_out(tmpfile())
-	, _tmp_err(tmpfile())
+static pthread_once_t handlersOnce = PTHREAD_ONCE_INIT;
+
+// Signal handlers and exit hooks are process-wide, so they are installed
+// only once, no matter how many consoles are created.
+static void installHandlers()
 {
 	signal(SIGBUS, gotsig);
 	signal(SIGSEGV, gotsig);
@@ -319,11 +1458,65 @@ SerializedOutputConsole::SerializedOutputConsole(bool DebugMode)
 	signal(SIGSYS, gotsig);
 	signal(SIGXCPU, gotsig);
 	signal(SIGXFSZ, gotsig);
+	signal(SIGPROF, cpuLimitExceeded);
 	atexit(goodbye);
+	// SIGUSR1 revives a checkpoint; until a checkpoint is waiting for it,
+	// it stays pending.
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &set, NULL);
+}
+
+SerializedOutputConsole::SerializedOutputConsole(bool DebugMode)
+	: _console(new Console(DebugMode))
+	, _checkpointsEnabled(false)
+	, _cpuLimit(0)
+	, _memLimit(0)
+{
+	init();
+	_console->warmUp();
+	sendReady();
+}
+
+SerializedOutputConsole::SerializedOutputConsole(Console *console)
+	: _console(console)
+	, _checkpointsEnabled(false)
+	, _cpuLimit(0)
+	, _memLimit(0)
+{
+	init();
+	sendReady();
+}
+
+void SerializedOutputConsole::init()
+{
+	// Frames go out on a duplicate of the original stdout, so that fds 1
+	// and 2 can be redirected to the forwarder.
+	protocolFd = dup(STDOUT_FILENO);
+	fcntl(protocolFd, F_SETFD, FD_CLOEXEC);
+	_forwarder.reset(new OutputForwarder(protocolFd));
+	if (_forwarder->start()) {
+		activeForwarder = _forwarder.get();
+	} else {
+		_forwarder.reset();
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	}
+	pthread_once(&handlersOnce, installHandlers);
+	_console->setExecutionListener(this);
+}
+
+void SerializedOutputConsole::sendReady()
+{
+	string pid = to_string(getpid());
+	const std::string *fields[] = { &pid };
+	sendFrame(ReadyFrame, fields, 1);
 }
 
 SerializedOutputConsole::~SerializedOutputConsole()
 {
+	if (activeForwarder == _forwarder.get())
+		activeForwarder = NULL;
 }
 
 const char * SerializedOutputConsole::prompt() const
@@ -336,60 +1529,178 @@ const char * SerializedOutputConsole::input() const
 	return _console->input();
 }
 
-namespace {
+Console * SerializedOutputConsole::getConsole() const
+{
+	return _console.get();
+}
 
-class StreamInterceptor {
+void SerializedOutputConsole::setCheckpointsEnabled(bool enabled)
+{
+	_checkpointsEnabled = enabled && _forwarder;
+}
 
-public:
-	
-	StreamInterceptor(FILE **stream, FILE *tmp_file)
-		: _stream(stream)
-		, _orig_stream(*stream)
-		, _tmp_file(tmp_file)
-	{
-		rewind(_tmp_file);
-		ftruncate(fileno(_tmp_file), 0);
-		*_stream = _tmp_file;
-	}
-
-	void getInterceptedOutput(std::stringstream& ss_out) {
-		char buf[16 * 1024];
-		*buf = '\0';
-		rewind(_tmp_file);
-		size_t nread = fread(buf, 1, sizeof(buf), _tmp_file);
-		buf[nread] = '\0';
-		ss_out << buf;
-		*_stream = _orig_stream;
+void SerializedOutputConsole::process(const char *line)
+{
+	string args;
+	string usage;
+	Console::InputStatus status;
+	if (MatchInternalCommand(line, "checkpoints", &args)) {
+		setCheckpointsEnabled(args == "on");
+		status = Console::InputQuery;
+	} else if (MatchInternalCommand(line, "limit", &args)) {
+		unsigned long cpu = 0;
+		unsigned long long mem = 0;
+		sscanf(args.c_str(), "cpu=%lu mem=%llu", &cpu, &mem);
+		_cpuLimit = cpu;
+		_memLimit = mem;
+		status = Console::InputQuery;
+	} else {
+		// The limits are set by willExecute() while a statement runs.
+		ResourceUsage start = ResourceUsage::current();
+		_console->process(line);
+		status = _console->lastInputStatus();
+		usage = ResourceUsage::current().since(start).serialize();
 	}
+	SerializedConsoleOutput sco("", "",
+	                            _console->prompt(),
+	                            _console->input(),
+	                            status);
+	sco.setUsage(usage);
+	sendReply(sco);
+}
 
-private:
+void SerializedOutputConsole::setLimits(bool enabled)
+{
+	if (_cpuLimit) {
+		struct itimerval timer;
+		memset(&timer, 0, sizeof(timer));
+		if (enabled) {
+			timer.it_value.tv_sec = _cpuLimit / 1000;
+			timer.it_value.tv_usec = (_cpuLimit % 1000) * 1000;
+		}
+		setitimer(ITIMER_PROF, &timer, NULL);
+	}
+	// Only the soft limit is changed, since lowering the hard limit cannot
+	// be undone. Exceeding it makes allocations fail.
+	struct rlimit limit;
+	if (_memLimit && getrlimit(RLIMIT_AS, &limit) == 0) {
+		rlim_t soft = RLIM_INFINITY;
+		if (enabled)
+			soft = addressSpaceSize() + _memLimit;
+		limit.rlim_cur = std::min(soft, limit.rlim_max);
+		setrlimit(RLIMIT_AS, &limit);
+	}
+}
 
-	FILE **_stream;
-	FILE *_orig_stream;
-	FILE *_tmp_file;
+bool SerializedOutputConsole::willExecute(const std::string& fName)
+{
+	if (!_checkpointsEnabled) {
+		setLimits(true);
+		return true;
+	}
 
-};
+	// Reap the checkpoints that RemoteConsole has discarded.
+	for (unsigned i = 0; i < _checkpoints.size(); ) {
+		if (waitpid(_checkpoints[i], NULL, WNOHANG) != 0)
+			_checkpoints.erase(_checkpoints.begin() + i);
+		else
+			++i;
+	}
 
-} // anon namespace
+	std::cout.flush();
+	std::cerr.flush();
+	fflush(stdout);
+	fflush(stderr);
+	_forwarder->prepareFork();
+	pid_t pid = fork();
+	if (pid != 0) {
+		_forwarder->parentAfterFork();
+		if (pid > 0) {
+			_checkpoints.push_back(pid);
+			string str = to_string(pid);
+			const std::string *fields[] = { &str };
+			sendFrame(CheckpointFrame, fields, 1);
+		}
+		// The checkpoint is not limited, as it does not run the statement.
+		setLimits(true);
+		return true;
+	}
 
-void SerializedOutputConsole::process(const char *line)
+	// This is the checkpoint: a copy-on-write snapshot of the state right
+	// before fName() runs. It sleeps until RemoteConsole revives it in
+	// place of the current process, and then skips running fName().
+	_forwarder->childAfterFork();
+	_checkpoints.clear();
+	waitForRevival();
+	_forwarder->resume();
+	return false;
+}
+
+void SerializedOutputConsole::didExecute(const std::string& fName)
 {
-	_ss_out.str("");
-	_ss_err.str("");
-	StreamInterceptor iout(&stdout, _tmp_out);
-	StreamInterceptor ierr(&stderr, _tmp_err);
-	_console->process(line);
-	iout.getInterceptedOutput(_ss_out);
-	ierr.getInterceptedOutput(_ss_err);
-	string str;
-	SerializedConsoleOutput sco(_ss_out.str(),
-	                            _ss_err.str(),
-	                            _console->prompt(),
-	                            _console->input());
-	sco.writeToString(&str);
-	std::cout << str;
-	std::cout.flush();
+	setLimits(false);
 }
 
+void SerializedOutputConsole::waitForRevival()
+{
+	if (pipe(reviveFds) != 0)
+		_exit(1);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = revive;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	sigprocmask(SIG_UNBLOCK, &set, NULL);
+
+	// Exit once RemoteConsole is gone, which closes the input pipe.
+	struct pollfd fds[2];
+	fds[0].fd = reviveFds[0];
+	fds[0].events = POLLIN;
+	fds[1].fd = STDIN_FILENO;
+	fds[1].events = 0;
+	for (;;) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			_exit(1);
+		}
+		if (fds[0].revents & POLLIN)
+			break;
+		if (fds[1].revents & (POLLHUP | POLLERR | POLLNVAL))
+			_exit(0);
+	}
+
+	sigprocmask(SIG_BLOCK, &set, NULL);
+	close(reviveFds[0]);
+	close(reviveFds[1]);
+	reviveFds[0] = reviveFds[1] = -1;
+}
+
+//
+// SerializedInputReader
+//
+
+SerializedInputReader::SerializedInputReader()
+{
+}
+
+const char * SerializedInputReader::readLine(const char *prompt, const char *input)
+{
+	// Input is read straight from the file descriptor, with no buffering, so
+	// that a checkpoint forked after a line does not hold on to later ones.
+	uint8_t type;
+	std::vector<std::string> fields;
+	if (!readFrame(STDIN_FILENO, &type, &fields) ||
+	    type != InputFrame || fields.size() != 1)
+		return NULL;
+
+	_line = fields[0];
+	if (_line.empty() || _line[_line.size() - 1] != '\n')
+		_line += "\n";
+	return _line.c_str();
+}
 
 } // namespace ccons
@@ -3,10 +3,16 @@
 
 //
 // RemoteConsole is an implementation of IConsole which spawns and communicates
-// with a second ccons process for handling the user input.
+// with a second ccons process for handling the user input. The child forks
+// checkpoints of itself, so that a crash (or :undo) rolls back to the state
+// before a statement. Otherwise, a warm spare process is kept ready to take
+// over if the child crashes, and the inputs of the session are replayed
+// into it.
 //
 // SerializedOutputConsole is used by the ccons process spawned by RemoteConsole
-// to send its output in a serialized format.
+// to send its output in a serialized format, streaming anything written to
+// stdout and stderr as it is produced. SerializedInputReader reads the input
+// that a RemoteConsole sends to it.
 //
 // Part of ccons, the interactive console for the C programming language.
 //
@@ -14,14 +20,20 @@
 // terms of MIT Open Source License. See file LICENSE for details.
 //
 
+#include <stdint.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <deque>
 #include <string>
-#include <sstream>
+#include <vector>
 
 #include "Console.h"
+#include "LineReader.h"
 
 namespace ccons {
 
+class OutputForwarder;
+
 //
 // RemoteConsole
 //
@@ -30,49 +42,168 @@ class RemoteConsole : public IConsole {
 
 public:
 
-	RemoteConsole(const char * command, bool DebugMode);
+	// Spawns command, passing it the specified options in addition to
+	// the ones used to set up the serialized output.
+	RemoteConsole(const char * command,
+	              const std::vector<std::string>& options,
+	              bool DebugMode);
+	// Connects to the ccons server listening on the specified socket, which
+	// provides warm workers in place of spawned processes. Like spawned
+	// processes, two workers are in use at any time: the one running the
+	// session, and the spare. Their processes are signaled through the
+	// keepers of their sessions, as the server may run under another user.
+	RemoteConsole(const std::string& socketPath, bool DebugMode);
 	virtual ~RemoteConsole();
 
+	// Set the number of checkpoints of the child process to keep, which
+	// bounds how far back :undo can go.
+	void setMaxCheckpoints(unsigned maxCheckpoints);
+
+	// Print the resource usage of the child after every input.
+	void setPrintUsage(bool printUsage);
+
 	const char * prompt() const;
 	const char * input() const;
 	void process(const char *line);
 
 private:
 
+	struct ChildProcess {
+		pid_t pid;
+		FILE *ostream;
+		int ifd;
+		int controlFd;  // the control socket of a server worker, or -1
+	};
+
 	std::string _command;
+	std::vector<std::string> _options;
+	std::string _socketPath;
 	bool _DebugMode;
-	FILE *_ostream;
-	FILE *_istream;
+	ChildProcess _child;
+	ChildProcess _spare;
 	std::string _prompt;
 	std::string _input;
-
+	// Inputs accepted by the child without errors, which are replayed into
+	// a restarted child.
+	std::vector<std::string> _journal;
+	std::string _pendingInput;
+	bool _replayExecutes;
+
+	// Forked copies of the child, taken before it runs each statement.
+	struct Checkpoint {
+		pid_t pid;
+		size_t journalSize;
+		unsigned inputNo;
+	};
+
+	std::deque<Checkpoint> _checkpoints;
+	unsigned _maxCheckpoints;
+	unsigned _inputNo;
+
+	// Limits per evaluation, or 0 if not set. The wall-time limit is
+	// enforced by a watchdog in this process, using the deadline of the
+	// current evaluation.
+	double _cpuLimit;
+	uint64_t _memLimit;
+	double _wallLimit;
+	uint64_t _deadline;
+
+	bool _printUsage;
+	std::string _lastUsage;
+
+	void init();
 	void cleanup();
 	void reset();
 
+	bool spawnChild(ChildProcess *child);
+	void closeChild(ChildProcess *child);
+	bool readUntil(ChildProcess *child, uint8_t type, std::vector<std::string> *fields);
+	bool waitForFrame(ChildProcess *child);
+	int signalProcess(ChildProcess *child, pid_t pid, int signo);
+	void restart();
+
+	void addCheckpoint(pid_t pid);
+	void trimCheckpoints();
+	void discardCheckpoints();
+	bool reviveCheckpoint(unsigned index);
+	void handleUndoCommand(const char *arg);
+
+	bool sendLimits();
+	void handleLimitCommand(const char *arg);
+	void handleUsageCommand(const char *arg);
+
+	void recordInput(const char *line, Console::InputStatus status);
+	bool replayJournal();
+	void handleJournalCommand(const char *arg);
+
 };
 
 //
 // SerializedOutputConsole
 //
+// Runs a Console on behalf of a RemoteConsole. It takes over the standard
+// output of the process, so there can be only one per process; concurrent
+// sessions within a process should use Console directly.
+//
 
-class SerializedOutputConsole : public IConsole {
+class SerializedOutputConsole : public IConsole, public ExecutionListener {
 
 public:
 
 	explicit SerializedOutputConsole(bool DebugMode);
+	// Takes ownership of a console that has already been warmed up.
+	explicit SerializedOutputConsole(Console *console);
 	virtual ~SerializedOutputConsole();
 
 	const char * prompt() const;
 	const char * input() const;
 	void process(const char *line);
 
+	Console * getConsole() const;
+
+	// When enabled, a checkpoint of the process is forked before each
+	// statement is run.
+	void setCheckpointsEnabled(bool enabled);
+
+	bool willExecute(const std::string& fName);
+	void didExecute(const std::string& fName);
+
+private:
+
+	llvm::OwningPtr<OutputForwarder> _forwarder;
+	llvm::OwningPtr<Console> _console;
+	bool _checkpointsEnabled;
+	std::vector<pid_t> _checkpoints;
+	// Limits on running a statement, or 0 if not set: CPU time in
+	// milliseconds, and bytes of address space on top of what is in use.
+	unsigned long _cpuLimit;
+	unsigned long long _memLimit;
+
+	void init();
+	void sendReady();
+	void waitForRevival();
+	void setLimits(bool enabled);
+
+};
+
+//
+// SerializedInputReader
+//
+// Reads the lines of input sent by a RemoteConsole from stdin, one frame per
+// line, so that a line is passed on as-is whatever bytes it contains.
+//
+
+class SerializedInputReader : public LineReader {
+
+public:
+
+	SerializedInputReader();
+
+	const char * readLine(const char *prompt, const char *input);
+
 private:
 
-	llvm::OwningPtr<IConsole> _console;
-	std::stringstream _ss_out;
-	std::stringstream _ss_err;
-	FILE *_tmp_out;
-	FILE *_tmp_err;
+	std::string _line;
 
 };
 
@@ -0,0 +1,292 @@
+//
+// Implementation of the ccons server, which keeps a pool of pre-forked
+// workers waiting for clients on a Unix domain socket.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "Server.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <set>
+
+#include "StringUtils.h"
+
+namespace ccons {
+
+namespace {
+
+volatile sig_atomic_t stopRequested = 0;
+
+void requestStop(int signo)
+{
+	stopRequested = 1;
+}
+
+bool makeAddress(const std::string& socketPath, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (socketPath.length() >= sizeof(addr->sun_path)) {
+		oprintf(std::cerr, "Socket path '%s' is too long.\n", socketPath.c_str());
+		return false;
+	}
+	strcpy(addr->sun_path, socketPath.c_str());
+	return true;
+}
+
+// Sends fd to the other end of the connection, along with a single byte.
+bool sendFd(int connFd, int fd)
+{
+	char byte = 0;
+	struct iovec iov;
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	char control[CMSG_SPACE(sizeof(int))];
+	memset(control, 0, sizeof(control));
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	return sendmsg(connFd, &msg, 0) == 1;
+}
+
+// Receives the fd sent by sendFd(), or returns -1.
+int receiveFd(int connFd)
+{
+	char byte;
+	struct iovec iov;
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	ssize_t n;
+	do {
+		n = recvmsg(connFd, &msg, 0);
+	} while (n == -1 && errno == EINTR);
+	struct cmsghdr *cmsg = n == 1 ? CMSG_FIRSTHDR(&msg) : NULL;
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+		errno = EPROTO;
+		return -1;
+	}
+	int fd;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	return fd;
+}
+
+// Carries out the requests that the client sends on the control socket of
+// its session, until it closes it. A request is a pid and a signal number,
+// and the reply is 0 or the errno of sending the signal. Only processes of
+// the session, which share the process group of the keeper, are signaled.
+void keepSession(int controlFd, pid_t session)
+{
+	FILE *requests = fdopen(controlFd, "r");
+	long pid;
+	int signo;
+	while (requests && fscanf(requests, "%ld %d", &pid, &signo) == 2) {
+		// Reaped processes no longer look alive.
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			;
+		int error = 0;
+		if (pid <= 0 || pid == getpid() || getpgid(pid) != getpgrp())
+			error = ESRCH;
+		else if (kill(pid, signo) != 0)
+			error = errno;
+		std::string reply = to_string(error) + "\n";
+		if (write(controlFd, reply.data(), reply.size()) != (ssize_t) reply.size())
+			break;
+	}
+	if (requests)
+		fclose(requests);
+	waitpid(session, NULL, 0);
+}
+
+// Waits for a client in a freshly forked worker. Returns true in the
+// process that serves the client, and false if the worker should exit.
+bool serveClient(int listenFd)
+{
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+
+	int connFd;
+	do {
+		connFd = accept(listenFd, NULL, NULL);
+	} while (connFd == -1 && errno == EINTR);
+	if (connFd == -1)
+		return false;
+	close(listenFd);
+
+	// The client gets the control socket before anything else.
+	int control[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, control) != 0) {
+		close(connFd);
+		return false;
+	}
+	bool sent = sendFd(connFd, control[1]);
+	close(control[1]);
+	if (!sent) {
+		close(control[0]);
+		close(connFd);
+		return false;
+	}
+
+	// The session gets a process group of its own, which tells its
+	// processes apart from those of other sessions.
+	setpgid(0, 0);
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(control[0]);
+		dup2(connFd, STDIN_FILENO);
+		dup2(connFd, STDOUT_FILENO);
+		close(connFd);
+		return true;
+	}
+	close(connFd);
+	if (pid > 0)
+		keepSession(control[0], pid);
+	else
+		close(control[0]);
+	return false;
+}
+
+} // anon namespace
+
+bool RunServer(const std::string& socketPath, unsigned workers)
+{
+	struct sockaddr_un addr;
+	if (!makeAddress(socketPath, &addr))
+		return false;
+
+	int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenFd == -1) {
+		perror("socket");
+		return false;
+	}
+	unlink(socketPath.c_str());
+	if (bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+	    listen(listenFd, 16) != 0) {
+		oprintf(std::cerr, "Could not listen on '%s': %s\n",
+		        socketPath.c_str(), strerror(errno));
+		close(listenFd);
+		return false;
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = requestStop;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGPIPE, SIG_IGN);
+
+	oprintf(std::cerr, "Listening on '%s' with %u workers.\n",
+	        socketPath.c_str(), workers);
+
+	// Workers serve a single client and exit once it disconnects, so that
+	// every client starts out with the state set up by the supervisor.
+	std::set<pid_t> pool;
+	while (!stopRequested) {
+		while (pool.size() < workers && !stopRequested) {
+			fflush(stdout);
+			fflush(stderr);
+			pid_t pid = fork();
+			if (pid == 0) {
+				if (serveClient(listenFd))
+					return true;
+				_exit(0);
+			}
+			if (pid == -1) {
+				perror("fork");
+				break;
+			}
+			pool.insert(pid);
+		}
+		pid_t pid = wait(NULL);
+		if (pid > 0)
+			pool.erase(pid);
+		else if (errno == ECHILD)
+			sleep(1);
+	}
+
+	for (std::set<pid_t>::iterator I = pool.begin(), E = pool.end(); I != E; ++I)
+		kill(*I, SIGTERM);
+	close(listenFd);
+	unlink(socketPath.c_str());
+	exit(0);
+}
+
+int ConnectToServer(const std::string& socketPath, int *controlFd)
+{
+	struct sockaddr_un addr;
+	if (!makeAddress(socketPath, &addr))
+		return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+	    (*controlFd = receiveFd(fd)) == -1) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+int SignalSessionProcess(int controlFd, pid_t pid, int signo)
+{
+	std::string request = to_string((long) pid) + " " + to_string(signo) + "\n";
+	if (write(controlFd, request.data(), request.size()) != (ssize_t) request.size())
+		return -1;
+	std::string reply;
+	char c;
+	for (;;) {
+		ssize_t n = read(controlFd, &c, 1);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n != 1) {
+			// The keeper is gone, and so is the session.
+			errno = ESRCH;
+			return -1;
+		}
+		if (c == '\n')
+			break;
+		reply += c;
+	}
+	int error = atoi(reply.c_str());
+	if (error == 0)
+		return 0;
+	errno = error;
+	return -1;
+}
+
+} // namespace ccons
@@ -0,0 +1,54 @@
+#ifndef CCONS_SERVER_H
+#define CCONS_SERVER_H
+
+//
+// A ccons server is a long-lived supervisor process that keeps a pool of
+// pre-forked, warmed-up workers waiting for clients on a Unix domain socket.
+// Each client gets a worker of its own, which talks to it using the same
+// protocol as the child process of a RemoteConsole. A RemoteConsole takes
+// two workers: one to run its session, and a warm spare that takes over if
+// it crashes.
+//
+// The server may run under another user than its clients, which therefore
+// cannot signal its processes. Instead, the worker that accepts a client
+// stays behind as the keeper of the session, and forks the process that
+// serves the client. The keeper signals the processes of the session, such
+// as its checkpoints, on behalf of the client, which asks for it on a
+// control socket of its own.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include <sys/types.h>
+
+#include <string>
+
+namespace ccons {
+
+// Listens on the specified socket and keeps the specified number of workers
+// forked. Everything set up before the call, such as a warmed-up Console,
+// is shared by the workers through copy-on-write memory.
+//
+// Returns true only in a worker, once a client has connected to it. The
+// standard input and output of the worker are then the connection.
+// Returns false if the socket could not be set up; otherwise the
+// supervisor runs until it is interrupted, and then exits.
+bool RunServer(const std::string& socketPath, unsigned workers);
+
+// Connects to the server listening on the specified socket, returning the
+// connected socket, or -1 on error. The control socket of the session is
+// returned in controlFd.
+int ConnectToServer(const std::string& socketPath, int *controlFd);
+
+// Has the keeper of a session send signo to pid, a process of the session,
+// through the control socket returned by ConnectToServer(). A signo of 0
+// checks whether the process still exists. Returns 0 on success, or -1
+// with errno set, like kill().
+int SignalSessionProcess(int controlFd, pid_t pid, int signo);
+
+} // namespace ccons
+
+#endif // CCONS_SERVER_H
@@ -0,0 +1,119 @@
+//
+// Measures how independent libccons sessions scale across threads. Each
+// thread runs its own session through the same sequence of inputs, and the
+// throughput for every thread count is compared to that of a single thread.
+//
+// Usage: ccons-session-bench [max threads] [inputs per session]
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "libccons.h"
+
+namespace {
+
+struct Worker {
+	pthread_t thread;
+	unsigned inputs;
+	unsigned failures;
+};
+
+double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void * runSession(void *arg)
+{
+	Worker *worker = (Worker *) arg;
+	ccons_session *session = ccons_session_new();
+	if (!session) {
+		worker->failures = worker->inputs;
+		return NULL;
+	}
+	if (ccons_eval(session, "int total;", NULL) != CCONS_OK)
+		worker->failures++;
+	if (ccons_eval(session, "int square(int x) { return x * x; }", NULL) != CCONS_OK)
+		worker->failures++;
+	for (unsigned i = 0; i < worker->inputs; i++) {
+		if (ccons_eval(session, "total += square(3);", NULL) != CCONS_OK)
+			worker->failures++;
+	}
+	ccons_session_free(session);
+	return NULL;
+}
+
+// Runs the specified number of sessions concurrently, returning the wall
+// time taken, or a negative value on failure.
+double runSessions(unsigned threads, unsigned inputs)
+{
+	std::vector<Worker> workers(threads);
+	double start = now();
+	for (unsigned i = 0; i < threads; i++) {
+		workers[i].inputs = inputs;
+		workers[i].failures = 0;
+		if (pthread_create(&workers[i].thread, NULL, runSession, &workers[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	unsigned failures = 0;
+	for (unsigned i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		failures += workers[i].failures;
+	}
+	return failures ? -1 : now() - start;
+}
+
+} // anon namespace
+
+int main(int argc, char **argv)
+{
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned maxThreads = argc > 1 ? atoi(argv[1]) : (cores > 0 ? cores : 1);
+	unsigned inputs = argc > 2 ? atoi(argv[2]) : 50;
+	if (maxThreads == 0 || inputs == 0) {
+		fprintf(stderr, "Usage: %s [max threads] [inputs per session]\n", argv[0]);
+		return 1;
+	}
+
+	// Initialize the target outside of the measurements.
+	ccons_session_free(ccons_session_new());
+
+	printf("%8s %12s %14s %10s %11s\n",
+	       "threads", "seconds", "inputs/sec", "speedup", "efficiency");
+	// Powers of two, followed by the maximum itself.
+	std::vector<unsigned> counts;
+	for (unsigned threads = 1; threads < maxThreads; threads *= 2)
+		counts.push_back(threads);
+	counts.push_back(maxThreads);
+
+	double baseline = 0;
+	for (unsigned i = 0; i < counts.size(); i++) {
+		unsigned threads = counts[i];
+		double seconds = runSessions(threads, inputs);
+		if (seconds < 0) {
+			fprintf(stderr, "Some inputs failed with %u threads.\n", threads);
+			return 1;
+		}
+		double rate = threads * inputs / seconds;
+		if (i == 0)
+			baseline = rate;
+		printf("%8u %12.3f %14.1f %9.2fx %10.0f%%\n", threads, seconds, rate,
+		       rate / baseline, 100 * rate / baseline / threads);
+	}
+	return 0;
+}
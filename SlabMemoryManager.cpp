@@ -0,0 +1,291 @@
+//
+// Implementation of SlabMemoryManager, which allocates the memory of the
+// JIT from large slabs.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "SlabMemoryManager.h"
+#include "Executor.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#include <llvm/Support/ErrorHandling.h>
+
+namespace ccons {
+
+namespace {
+
+// Function bodies are aligned like a compiler would align them.
+const size_t FunctionAlignment = 16;
+
+// A body is not started in less space than this, so that the JIT does not
+// run out of space over and over at the end of a slab.
+const size_t MinBlockSpace = 4096;
+
+uint8_t * alignUp(uint8_t *p, size_t alignment)
+{
+	return (uint8_t *) (((uintptr_t) p + alignment - 1) & ~(uintptr_t) (alignment - 1));
+}
+
+} // anon namespace
+
+const size_t SlabMemoryManager::SlabSize;
+
+SlabMemoryManager::SlabMemoryManager(bool hugePages)
+	: _hugePages(hugePages)
+	, _code(true)
+	, _stubs(true)
+	, _data(false)
+	, _got(NULL)
+	, _lastBlock(NULL)
+	// Symbols are resolved like the default manager does, since it knows
+	// about the functions of libc that are not exported, such as stat().
+	, _resolver(llvm::JITMemoryManager::CreateDefaultMemManager())
+{
+}
+
+SlabMemoryManager::~SlabMemoryManager()
+{
+	Arena *arenas[] = { &_code, &_stubs, &_data };
+	for (unsigned i = 0; i < sizeof(arenas) / sizeof(arenas[0]); i++) {
+		for (unsigned j = 0; j < arenas[i]->slabs.size(); j++) {
+			if (arenas[i]->executable)
+				Executor::removeCodeRange(arenas[i]->slabs[j].first);
+			munmap(arenas[i]->slabs[j].first, arenas[i]->slabs[j].second);
+		}
+	}
+}
+
+size_t SlabMemoryManager::getCodeBytes() const
+{
+	return _code.used + _stubs.used;
+}
+
+size_t SlabMemoryManager::getDataBytes() const
+{
+	return _data.used;
+}
+
+size_t SlabMemoryManager::getMappedBytes() const
+{
+	const Arena *arenas[] = { &_code, &_stubs, &_data };
+	size_t bytes = 0;
+	for (unsigned i = 0; i < sizeof(arenas) / sizeof(arenas[0]); i++) {
+		for (unsigned j = 0; j < arenas[i]->slabs.size(); j++)
+			bytes += arenas[i]->slabs[j].second;
+	}
+	return bytes;
+}
+
+void SlabMemoryManager::addSlab(Arena *arena, size_t minSize)
+{
+	size_t size = std::max(SlabSize, (minSize + SlabSize - 1) / SlabSize * SlabSize);
+	int prot = PROT_READ | PROT_WRITE | (arena->executable ? PROT_EXEC : 0);
+	// Huge pages need slabs aligned to their size, so a slab more is mapped
+	// and the excess unmapped.
+	size_t extra = _hugePages ? SlabSize : 0;
+	void *mapped = mmap(NULL, size + extra, prot, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (mapped == MAP_FAILED)
+		llvm::report_fatal_error("Could not map memory for the JIT.");
+	uint8_t *start = (uint8_t *) mapped;
+	if (extra) {
+		uint8_t *aligned = alignUp(start, SlabSize);
+		if (aligned != start)
+			munmap(start, aligned - start);
+		if (aligned + size != start + size + extra)
+			munmap(aligned + size, start + size + extra - (aligned + size));
+		start = aligned;
+#ifdef MADV_HUGEPAGE
+		madvise(start, size, MADV_HUGEPAGE);
+#endif
+	}
+	// Crashes in the code of the console are recovered from.
+	if (arena->executable)
+		Executor::addCodeRange(start, size);
+	// Whatever was left of the previous slab is abandoned.
+	arena->slabs.push_back(std::make_pair(start, size));
+	arena->next = start;
+	arena->end = start + size;
+}
+
+uint8_t * SlabMemoryManager::allocate(Arena *arena, size_t size, size_t alignment)
+{
+	alignment = std::max(alignment, (size_t) 1);
+	uint8_t *p = alignUp(arena->next, alignment);
+	if (!arena->next || p + size > arena->end) {
+		addSlab(arena, size + alignment);
+		p = alignUp(arena->next, alignment);
+	}
+	arena->next = p + size;
+	arena->used += size;
+	return p;
+}
+
+// Returns the rest of the current code slab for a function body or an
+// exception table, which may take up as much of it as needed. If the JIT
+// runs out of space, it gives the block back and asks for a larger one.
+uint8_t * SlabMemoryManager::startBlock(uintptr_t& actualSize)
+{
+	size_t wanted = std::max((size_t) actualSize, MinBlockSpace);
+	uint8_t *p = alignUp(_code.next, FunctionAlignment);
+	if (!_code.next || p + wanted > _code.end) {
+		addSlab(&_code, wanted + FunctionAlignment);
+		p = alignUp(_code.next, FunctionAlignment);
+	}
+	actualSize = _code.end - p;
+	_lastBlock = p;
+	return p;
+}
+
+// The code slabs are mapped writable and executable throughout, like the
+// memory of the default manager.
+void SlabMemoryManager::setMemoryWritable()
+{
+}
+
+void SlabMemoryManager::setMemoryExecutable()
+{
+}
+
+// No memory is ever freed, so there is nothing to poison.
+void SlabMemoryManager::setPoisonMemory(bool poison)
+{
+}
+
+void SlabMemoryManager::AllocateGOT()
+{
+	_got = allocate(&_data, sizeof(void *) * 8192, sizeof(void *));
+}
+
+uint8_t * SlabMemoryManager::getGOTBase() const
+{
+	return _got;
+}
+
+uint8_t * SlabMemoryManager::startFunctionBody(const llvm::Function *F,
+                                               uintptr_t& actualSize)
+{
+	return startBlock(actualSize);
+}
+
+// The JIT allocates stubs while it emits a function body, which takes up
+// the rest of the code slab, so they have slabs of their own.
+uint8_t * SlabMemoryManager::allocateStub(const llvm::GlobalValue *F,
+                                          unsigned stubSize,
+                                          unsigned alignment)
+{
+	return allocate(&_stubs, stubSize, alignment);
+}
+
+void SlabMemoryManager::endFunctionBody(const llvm::Function *F,
+                                        uint8_t *functionStart,
+                                        uint8_t *functionEnd)
+{
+	_code.next = functionEnd;
+	_code.used += functionEnd - functionStart;
+}
+
+uint8_t * SlabMemoryManager::allocateSpace(intptr_t size, unsigned alignment)
+{
+	return allocate(&_stubs, size, alignment);
+}
+
+uint8_t * SlabMemoryManager::allocateGlobal(uintptr_t size, unsigned alignment)
+{
+	return allocate(&_data, size, alignment);
+}
+
+// Only the last block can be reclaimed, which covers the JIT retrying with
+// more space; older code is left where it is.
+void SlabMemoryManager::deallocateFunctionBody(void *body)
+{
+	if (body && body == _lastBlock) {
+		_code.used -= _code.next - _lastBlock;
+		_code.next = _lastBlock;
+		_lastBlock = NULL;
+	}
+}
+
+uint8_t * SlabMemoryManager::startExceptionTable(const llvm::Function *F,
+                                                 uintptr_t& actualSize)
+{
+	return startBlock(actualSize);
+}
+
+void SlabMemoryManager::endExceptionTable(const llvm::Function *F,
+                                          uint8_t *tableStart,
+                                          uint8_t *tableEnd,
+                                          uint8_t *frameRegister)
+{
+	_code.next = tableEnd;
+	_code.used += tableEnd - tableStart;
+}
+
+void SlabMemoryManager::deallocateExceptionTable(void *table)
+{
+	deallocateFunctionBody(table);
+}
+
+size_t SlabMemoryManager::GetDefaultCodeSlabSize()
+{
+	return SlabSize;
+}
+
+size_t SlabMemoryManager::GetDefaultDataSlabSize()
+{
+	return SlabSize;
+}
+
+size_t SlabMemoryManager::GetDefaultStubSlabSize()
+{
+	return SlabSize;
+}
+
+unsigned SlabMemoryManager::GetNumCodeSlabs()
+{
+	return _code.slabs.size();
+}
+
+unsigned SlabMemoryManager::GetNumDataSlabs()
+{
+	return _data.slabs.size();
+}
+
+unsigned SlabMemoryManager::GetNumStubSlabs()
+{
+	return _stubs.slabs.size();
+}
+
+uint8_t * SlabMemoryManager::allocateCodeSection(uintptr_t size,
+                                                 unsigned alignment,
+                                                 unsigned sectionID)
+{
+	return allocate(&_stubs, size, alignment);
+}
+
+uint8_t * SlabMemoryManager::allocateDataSection(uintptr_t size,
+                                                 unsigned alignment,
+                                                 unsigned sectionID,
+                                                 bool isReadOnly)
+{
+	return allocate(&_data, size, alignment);
+}
+
+void * SlabMemoryManager::getPointerToNamedFunction(const std::string& name,
+                                                    bool abortOnFailure)
+{
+	return _resolver->getPointerToNamedFunction(name, abortOnFailure);
+}
+
+bool SlabMemoryManager::applyPermissions(std::string *errMsg)
+{
+	return false;
+}
+
+} // namespace ccons
@@ -0,0 +1,107 @@
+#ifndef CCONS_SLAB_MEMORY_MANAGER_H
+#define CCONS_SLAB_MEMORY_MANAGER_H
+
+//
+// SlabMemoryManager is the JITMemoryManager of ccons. It carves code, stubs
+// and global variables out of large slabs, so that the code of functions
+// compiled one after the other ends up next to each other, on few pages.
+// Every allocation gets the alignment it asks for, and slabs may be backed
+// by transparent huge pages. Memory is never returned to the system; the
+// old code of a recompiled function is simply abandoned.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/ExecutionEngine/JITMemoryManager.h>
+
+namespace ccons {
+
+class SlabMemoryManager : public llvm::JITMemoryManager {
+
+public:
+
+	// The size of a slab, which is that of a huge page on x86.
+	static const size_t SlabSize = 2 << 20;
+
+	explicit SlabMemoryManager(bool hugePages);
+	~SlabMemoryManager();
+
+	// The bytes allocated for code (including stubs) and for data, and the
+	// bytes of the slabs they were allocated from.
+	size_t getCodeBytes() const;
+	size_t getDataBytes() const;
+	size_t getMappedBytes() const;
+
+	// llvm::JITMemoryManager
+	void setMemoryWritable();
+	void setMemoryExecutable();
+	void setPoisonMemory(bool poison);
+	void AllocateGOT();
+	uint8_t * getGOTBase() const;
+	uint8_t * startFunctionBody(const llvm::Function *F, uintptr_t& actualSize);
+	uint8_t * allocateStub(const llvm::GlobalValue *F, unsigned stubSize,
+	                       unsigned alignment);
+	void endFunctionBody(const llvm::Function *F, uint8_t *functionStart,
+	                     uint8_t *functionEnd);
+	uint8_t * allocateSpace(intptr_t size, unsigned alignment);
+	uint8_t * allocateGlobal(uintptr_t size, unsigned alignment);
+	void deallocateFunctionBody(void *body);
+	uint8_t * startExceptionTable(const llvm::Function *F, uintptr_t& actualSize);
+	void endExceptionTable(const llvm::Function *F, uint8_t *tableStart,
+	                       uint8_t *tableEnd, uint8_t *frameRegister);
+	void deallocateExceptionTable(void *table);
+	size_t GetDefaultCodeSlabSize();
+	size_t GetDefaultDataSlabSize();
+	size_t GetDefaultStubSlabSize();
+	unsigned GetNumCodeSlabs();
+	unsigned GetNumDataSlabs();
+	unsigned GetNumStubSlabs();
+
+	// llvm::RTDyldMemoryManager
+	uint8_t * allocateCodeSection(uintptr_t size, unsigned alignment,
+	                              unsigned sectionID);
+	uint8_t * allocateDataSection(uintptr_t size, unsigned alignment,
+	                              unsigned sectionID, bool isReadOnly);
+	void * getPointerToNamedFunction(const std::string& name,
+	                                 bool abortOnFailure = true);
+	bool applyPermissions(std::string *errMsg = 0);
+
+private:
+
+	// A run of slabs that allocations of one kind are bumped out of.
+	struct Arena {
+		Arena(bool executable) : next(NULL), end(NULL), used(0), executable(executable) {}
+
+		uint8_t *next;
+		uint8_t *end;
+		size_t used;
+		bool executable;
+		std::vector<std::pair<uint8_t*, size_t> > slabs;
+	};
+
+	uint8_t * allocate(Arena *arena, size_t size, size_t alignment);
+	uint8_t * startBlock(uintptr_t& actualSize);
+	void addSlab(Arena *arena, size_t minSize);
+
+	bool _hugePages;
+	Arena _code;   // function bodies and exception tables
+	Arena _stubs;  // stubs and other code allocated while a body is open
+	Arena _data;   // global variables and the GOT
+	uint8_t *_got;
+	uint8_t *_lastBlock;  // the start of the last function body or table
+	llvm::OwningPtr<llvm::JITMemoryManager> _resolver;
+
+};
+
+} // namespace ccons
+
+#endif // CCONS_SLAB_MEMORY_MANAGER_H
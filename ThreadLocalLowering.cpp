@@ -0,0 +1,238 @@
+//
+// Lowers thread-local variables defined by user code, which the JIT cannot
+// emit, to calls to a runtime function backed by pthread keys.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "ThreadLocalLowering.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/DynamicLibrary.h>
+
+namespace {
+
+// The runtime state of a thread-local variable, created on first use, with
+// the instance of the thread that runs statements.
+struct ThreadLocal {
+	pthread_key_t key;
+	void *statementInstance;
+};
+
+pthread_mutex_t slotMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Instances get cache lines of their own, so that threads using their own
+// instances do not contend for them, and are preceded by a header in one.
+const size_t CacheLineSize = 64;
+struct InstanceHeader {
+	bool kept;
+};
+
+// Set on the thread that runs statements.
+__thread bool runsStatements;
+
+// Frees the instance of an exiting thread, unless the thread that runs
+// statements next takes it over.
+void releaseInstance(void *instance)
+{
+	InstanceHeader *header = (InstanceHeader *) ((char *) instance - CacheLineSize);
+	if (!header->kept)
+		free(header);
+}
+
+} // anon namespace
+
+// Returns the instance of a thread-local variable for the calling thread.
+// The slot is a global of the lowered code that holds the ThreadLocal of the
+// variable, and init holds its initial value.
+extern "C" void * __ccons_tls_get(void **slot, const void *init, unsigned long size)
+{
+	ThreadLocal *var = (ThreadLocal *) *slot;
+	if (!var) {
+		pthread_mutex_lock(&slotMutex);
+		var = (ThreadLocal *) *slot;
+		if (!var) {
+			var = new ThreadLocal;
+			pthread_key_create(&var->key, releaseInstance);
+			var->statementInstance = NULL;
+			__sync_synchronize();
+			*slot = var;
+		}
+		pthread_mutex_unlock(&slotMutex);
+	}
+
+	void *instance = pthread_getspecific(var->key);
+	if (!instance && runsStatements && var->statementInstance) {
+		// The thread that ran statements before is gone, such as in a
+		// revived checkpoint, which only has the thread that forked it.
+		instance = var->statementInstance;
+		pthread_setspecific(var->key, instance);
+	} else if (!instance) {
+		void *block;
+		if (posix_memalign(&block, CacheLineSize, CacheLineSize + (size ? size : 1)))
+			abort();
+		((InstanceHeader *) block)->kept = runsStatements;
+		instance = (char *) block + CacheLineSize;
+		memcpy(instance, init, size);
+		if (runsStatements)
+			var->statementInstance = instance;
+		pthread_setspecific(var->key, instance);
+	}
+	return instance;
+}
+
+namespace ccons {
+
+namespace {
+
+const char SlotPrefix[] = "__ccons_tls.";
+
+// Returns the slot of the specified variable in module, which is defined
+// along with the variable, and declared otherwise.
+llvm::GlobalVariable * getSlot(llvm::Module *module, llvm::GlobalVariable *GV)
+{
+	std::string name = SlotPrefix + GV->getName().str();
+	if (llvm::GlobalVariable *slot = module->getNamedGlobal(name))
+		return slot;
+	llvm::Type *type = llvm::Type::getInt8PtrTy(module->getContext());
+	if (GV->isDeclaration()) {
+		return new llvm::GlobalVariable(*module, type, false,
+			llvm::GlobalValue::ExternalLinkage, NULL, name);
+	}
+	return new llvm::GlobalVariable(*module, type, false,
+		GV->hasLocalLinkage() ? llvm::GlobalValue::InternalLinkage
+		                      : llvm::GlobalValue::ExternalLinkage,
+		llvm::Constant::getNullValue(type), name);
+}
+
+// Turns the uses of CE by instructions into instructions of their own, so
+// that every use of the variable it refers to is by an instruction.
+void expandConstantExpr(llvm::ConstantExpr *CE)
+{
+	std::vector<llvm::User*> users(CE->use_begin(), CE->use_end());
+	for (unsigned i = 0; i < users.size(); i++) {
+		if (llvm::ConstantExpr *user = llvm::dyn_cast<llvm::ConstantExpr>(users[i]))
+			expandConstantExpr(user);
+	}
+
+	users.assign(CE->use_begin(), CE->use_end());
+	for (unsigned i = 0; i < users.size(); i++) {
+		llvm::Instruction *I = llvm::dyn_cast<llvm::Instruction>(users[i]);
+		if (!I)
+			continue;
+		if (llvm::PHINode *PN = llvm::dyn_cast<llvm::PHINode>(I)) {
+			for (unsigned j = 0; j < PN->getNumIncomingValues(); j++) {
+				if (PN->getIncomingValue(j) != CE)
+					continue;
+				llvm::Instruction *NI = CE->getAsInstruction();
+				NI->insertBefore(PN->getIncomingBlock(j)->getTerminator());
+				PN->setIncomingValue(j, NI);
+			}
+		} else {
+			llvm::Instruction *NI = CE->getAsInstruction();
+			NI->insertBefore(I);
+			I->replaceUsesOfWith(CE, NI);
+		}
+	}
+}
+
+void lowerThreadLocal(llvm::Module *module, llvm::GlobalVariable *GV)
+{
+	std::vector<llvm::User*> users(GV->use_begin(), GV->use_end());
+	for (unsigned i = 0; i < users.size(); i++) {
+		if (llvm::ConstantExpr *CE = llvm::dyn_cast<llvm::ConstantExpr>(users[i]))
+			expandConstantExpr(CE);
+	}
+
+	llvm::LLVMContext& context = module->getContext();
+	llvm::Type *bytePtr = llvm::Type::getInt8PtrTy(context);
+	llvm::Type *int64 = llvm::Type::getInt64Ty(context);
+	llvm::Constant *get = module->getOrInsertFunction("__ccons_tls_get",
+		bytePtr, bytePtr->getPointerTo(), bytePtr, int64, NULL);
+	llvm::GlobalVariable *slot = getSlot(module, GV);
+	llvm::Constant *init = llvm::ConstantExpr::getBitCast(GV, bytePtr);
+	llvm::Constant *size = llvm::ConstantExpr::getSizeOf(GV->getType()->getElementType());
+
+	// Functions run on a single thread, so each looks up its instance once,
+	// on entry.
+	std::map<llvm::Function*, llvm::Value*> instances;
+	users.assign(GV->use_begin(), GV->use_end());
+	for (unsigned i = 0; i < users.size(); i++) {
+		llvm::Instruction *I = llvm::dyn_cast<llvm::Instruction>(users[i]);
+		if (!I)
+			continue;
+		llvm::Function *F = I->getParent()->getParent();
+		llvm::Value *&instance = instances[F];
+		if (!instance) {
+			llvm::IRBuilder<> builder(F->getEntryBlock().getFirstInsertionPt());
+			llvm::Value *address = builder.CreateCall3(get, slot, init, size);
+			instance = builder.CreateBitCast(address, GV->getType(), GV->getName());
+		}
+		I->replaceUsesOfWith(GV, instance);
+	}
+
+	GV->setThreadLocal(false);
+}
+
+} // anon namespace
+
+void LowerThreadLocals(llvm::Module *module, const llvm::Module *linked)
+{
+	std::vector<llvm::GlobalVariable*> lowered;
+	for (llvm::Module::global_iterator GV = module->global_begin(), E = module->global_end();
+	     GV != E; ++GV) {
+		if (!GV->isThreadLocal())
+			continue;
+		// Declarations of variables that user code did not define, such as
+		// those of libraries, are left alone.
+		if (GV->isDeclaration() &&
+		    !(linked && linked->getNamedGlobal(SlotPrefix + GV->getName().str())))
+			continue;
+		lowered.push_back(GV);
+	}
+	for (unsigned i = 0; i < lowered.size(); i++)
+		lowerThreadLocal(module, lowered[i]);
+}
+
+llvm::GlobalVariable * GetThreadLocalSlot(llvm::Module *linked,
+                                          const llvm::GlobalVariable *GV)
+{
+	llvm::GlobalVariable *slot = linked->getNamedGlobal(SlotPrefix + GV->getName().str());
+	return slot && !slot->isDeclaration() ? slot : NULL;
+}
+
+void SetStatementThread()
+{
+	runsStatements = true;
+}
+
+static pthread_once_t runtimeOnce = PTHREAD_ONCE_INIT;
+
+static void addRuntimeSymbols()
+{
+	llvm::sys::DynamicLibrary::AddSymbol("__ccons_tls_get", (void *) __ccons_tls_get);
+}
+
+void RegisterThreadLocalRuntime()
+{
+	pthread_once(&runtimeOnce, addRuntimeSymbols);
+}
+
+} // namespace ccons
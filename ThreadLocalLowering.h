@@ -0,0 +1,49 @@
+#ifndef CCONS_THREAD_LOCAL_LOWERING_H
+#define CCONS_THREAD_LOCAL_LOWERING_H
+
+//
+// The JIT cannot emit thread-local variables, so those defined by user code
+// are lowered to ordinary globals holding their initial values, with every
+// access going through __ccons_tls_get(), which returns the instance of the
+// calling thread, creating it on first use. The instances of the thread that
+// runs statements outlive it, so that the thread of a revived checkpoint
+// carries on with their values.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+namespace llvm {
+	class GlobalVariable;
+	class Module;
+} // namespace llvm
+
+// Returns the instance of a lowered thread-local variable for the calling
+// thread, given its slot and its initial value.
+extern "C" void * __ccons_tls_get(void **slot, const void *init, unsigned long size);
+
+namespace ccons {
+
+// Lowers the thread-local variables that the specified module defines, as
+// well as its references to those that earlier modules, already linked into
+// linked (which may be NULL), defined.
+void LowerThreadLocals(llvm::Module *module, const llvm::Module *linked);
+
+// Returns the slot of the specified variable of linked if it is a lowered
+// thread-local variable, or NULL otherwise. The variable itself only holds
+// the initial value.
+llvm::GlobalVariable * GetThreadLocalSlot(llvm::Module *linked,
+                                          const llvm::GlobalVariable *GV);
+
+// Marks the calling thread as the one that runs statements. It takes over
+// the instances of the thread that ran them before, if any.
+void SetStatementThread();
+
+// Makes __ccons_tls_get() available to JIT-compiled code.
+void RegisterThreadLocalRuntime();
+
+} // namespace ccons
+
+#endif // CCONS_THREAD_LOCAL_LOWERING_H
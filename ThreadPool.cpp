@@ -0,0 +1,402 @@
+//
+// ThreadPool runs parallel loops for snippets, with work stealing between
+// its threads.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "ThreadPool.h"
+#include "FPControl.h"
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <llvm/Support/DynamicLibrary.h>
+
+namespace ccons {
+
+namespace {
+
+// Set on threads that are running a chunk of a loop.
+__thread bool inLoop;
+
+pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+ThreadPool *pool;
+
+} // anon namespace
+
+void ThreadPool::createInstance()
+{
+	pool = new ThreadPool;
+}
+
+ThreadPool * ThreadPool::instance()
+{
+	pthread_once(&poolOnce, createInstance);
+	return pool;
+}
+
+ThreadPool::ThreadPool()
+	: _owner(getpid())
+	, _generation(0)
+	, _startGeneration(0)
+	, _busy(0)
+	, _quit(false)
+	, _begin(0)
+	, _end(0)
+	, _chunkSize(1)
+	, _fn(NULL)
+	, _ctx(NULL)
+	, _flushDenormals(false)
+	, _stopSignal(0)
+{
+	pthread_mutex_init(&_loopMutex, NULL);
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_wake, NULL);
+	pthread_cond_init(&_done, NULL);
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	startWorkers(cpus > 1 ? cpus - 1 : 0);
+}
+
+unsigned ThreadPool::size()
+{
+	pthread_mutex_lock(&_loopMutex);
+	unsigned size = _queues.size();
+	pthread_mutex_unlock(&_loopMutex);
+	return size;
+}
+
+void ThreadPool::setSize(unsigned size)
+{
+	pthread_mutex_lock(&_loopMutex);
+	stopWorkers();
+	startWorkers(size > 1 ? size - 1 : 0);
+	pthread_mutex_unlock(&_loopMutex);
+}
+
+void ThreadPool::startWorkers(unsigned count)
+{
+	// The thread that starts a loop works on the first queue.
+	for (unsigned i = 0; i <= count; i++) {
+		Queue *queue = new Queue;
+		pthread_mutex_init(&queue->lock, NULL);
+		queue->next = queue->last = 0;
+		_queues.push_back(queue);
+	}
+	_traps.resize(_queues.size());
+	_quit = false;
+	_owner = getpid();
+	_startGeneration = _generation;
+	for (unsigned i = 1; i <= count; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, threadMain, (void *) (intptr_t) i))
+			break;
+		_workers.push_back(thread);
+	}
+	// Queues without a thread to work on them would only be reached by
+	// stealing.
+	while (_queues.size() > _workers.size() + 1) {
+		pthread_mutex_destroy(&_queues.back()->lock);
+		delete _queues.back();
+		_queues.pop_back();
+	}
+}
+
+void ThreadPool::stopWorkers()
+{
+	// A forked process does not have the threads of its parent, and the
+	// locks they held may never be released.
+	if (_owner == getpid()) {
+		pthread_mutex_lock(&_mutex);
+		_quit = true;
+		pthread_cond_broadcast(&_wake);
+		pthread_mutex_unlock(&_mutex);
+		for (unsigned i = 0; i < _workers.size(); i++)
+			pthread_join(_workers[i], NULL);
+	} else {
+		pthread_mutex_init(&_mutex, NULL);
+		pthread_cond_init(&_wake, NULL);
+		pthread_cond_init(&_done, NULL);
+	}
+	_workers.clear();
+	for (unsigned i = 0; i < _queues.size(); i++)
+		delete _queues[i];
+	_queues.clear();
+	_traps.clear();
+}
+
+void * ThreadPool::threadMain(void *arg)
+{
+	ThreadPool *pool = instance();
+	unsigned self = (intptr_t) arg;
+	void *altStack = Executor::installSignalStack();
+	pthread_mutex_lock(&pool->_mutex);
+	// A loop may have started before this thread got to run.
+	unsigned seen = pool->_startGeneration;
+	for (;;) {
+		while (!pool->_quit && pool->_generation == seen)
+			pthread_cond_wait(&pool->_wake, &pool->_mutex);
+		if (pool->_quit)
+			break;
+		seen = pool->_generation;
+		pthread_mutex_unlock(&pool->_mutex);
+		Executor::setTrap(&pool->_traps[self]);
+		pool->work(self);
+		Executor::setTrap(NULL);
+		pthread_mutex_lock(&pool->_mutex);
+		if (--pool->_busy == 0)
+			pthread_cond_signal(&pool->_done);
+	}
+	pthread_mutex_unlock(&pool->_mutex);
+	Executor::removeSignalStack(altStack);
+	return NULL;
+}
+
+long ThreadPool::chunkSize(long begin, long end, long grain)
+{
+	if (grain > 0)
+		return grain;
+	// Enough chunks per thread to even out the load.
+	long chunks = 8 * (long) (_workers.size() + 1);
+	return std::max(1L, (end - begin + chunks - 1) / chunks);
+}
+
+void ThreadPool::parallelFor(long begin, long end, long grain,
+                             void (*fn)(long lo, long hi, void *ctx), void *ctx)
+{
+	if (begin >= end)
+		return;
+	if (inLoop) {
+		fn(begin, end, ctx);
+		return;
+	}
+
+	pthread_mutex_lock(&_loopMutex);
+	if (_owner != getpid()) {
+		unsigned count = _queues.size() - 1;
+		stopWorkers();
+		startWorkers(count);
+	}
+
+	_begin = begin;
+	_end = end;
+	_chunkSize = chunkSize(begin, end, grain);
+	_fn = fn;
+	_ctx = ctx;
+	_flushDenormals = DenormalsFlushed();
+	_stopSignal = 0;
+
+	// Only the loops of the code that SIGINT interrupts are interrupted.
+	const bool interruptible = Executor::isForeground();
+	for (unsigned i = 0; i < _traps.size(); i++) {
+		_traps[i].armed = 0;
+		_traps[i].interruptible = interruptible;
+		_traps[i].signal = &_stopSignal;
+	}
+
+	// Each queue starts out with an equal share of consecutive chunks.
+	const long chunks = (end - begin + _chunkSize - 1) / _chunkSize;
+	const long queues = _queues.size();
+	for (long i = 0; i < queues; i++) {
+		_queues[i]->next = chunks * i / queues;
+		_queues[i]->last = chunks * (i + 1) / queues;
+	}
+
+	pthread_mutex_lock(&_mutex);
+	_busy = _workers.size();
+	_generation++;
+	pthread_cond_broadcast(&_wake);
+	pthread_mutex_unlock(&_mutex);
+
+	// Until the workers are done, an interrupt or a crash on this thread
+	// only stops the loop, as ctx may point into the frames it would
+	// otherwise unwind.
+	Executor::setTrap(&_traps[0]);
+	work(0);
+	waitForWorkers();
+	Executor::setTrap(NULL);
+
+	const int signo = _stopSignal;
+	pthread_mutex_unlock(&_loopMutex);
+	if (signo)
+		Executor::unwind(signo);
+}
+
+void ThreadPool::waitForWorkers()
+{
+	bool stopping = false;
+	pthread_mutex_lock(&_mutex);
+	while (_busy > 0) {
+		// Workers notice that the loop was stopped between chunks, and
+		// those in the middle of one are interrupted.
+		if (_stopSignal && !stopping) {
+			stopping = true;
+			for (unsigned i = 0; i < _workers.size(); i++) {
+				if (_traps[i + 1].armed)
+					pthread_kill(_workers[i], SIGINT);
+			}
+		}
+		// The signal that stops the loop may arrive while waiting, so the
+		// wait cannot be unbounded.
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		struct timespec deadline;
+		deadline.tv_sec = now.tv_sec;
+		deadline.tv_nsec = now.tv_usec * 1000 + 50 * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&_done, &_mutex, &deadline);
+	}
+	pthread_mutex_unlock(&_mutex);
+}
+
+void ThreadPool::work(unsigned self)
+{
+	Executor::Trap *trap = &_traps[self];
+	inLoop = true;
+	SetDenormalsFlushed(_flushDenormals);
+	// A crash in a chunk, or an interrupt, unwinds back here, having
+	// recorded the signal in _stopSignal.
+	if (sigsetjmp(trap->jmpBuf, 1) == 0) {
+		long chunk;
+		while (!_stopSignal && takeChunk(self, &chunk)) {
+			long lo = _begin + chunk * _chunkSize;
+			long hi = std::min(_end, lo + _chunkSize);
+			trap->armed = 1;
+			_fn(lo, hi, _ctx);
+			trap->armed = 0;
+		}
+	}
+	inLoop = false;
+}
+
+bool ThreadPool::takeChunk(unsigned self, long *chunk)
+{
+	Queue *own = _queues[self];
+	pthread_mutex_lock(&own->lock);
+	bool found = own->next < own->last;
+	if (found)
+		*chunk = own->next++;
+	pthread_mutex_unlock(&own->lock);
+	if (found)
+		return true;
+
+	// Steal the back half of the chunks left in another queue.
+	const unsigned queues = _queues.size();
+	for (unsigned i = 1; i < queues; i++) {
+		Queue *victim = _queues[(self + i) % queues];
+		pthread_mutex_lock(&victim->lock);
+		long left = victim->last - victim->next;
+		long first = victim->last - (left + 1) / 2;
+		if (left > 0)
+			victim->last = first;
+		pthread_mutex_unlock(&victim->lock);
+		if (left > 0) {
+			pthread_mutex_lock(&own->lock);
+			own->next = first + 1;
+			own->last = first + (left + 1) / 2;
+			pthread_mutex_unlock(&own->lock);
+			*chunk = first;
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace ccons
+
+//
+// Runtime functions called by JIT-compiled code.
+//
+
+using ccons::ThreadPool;
+
+namespace {
+
+struct ReduceLoop {
+	double (*fn)(long lo, long hi, void *ctx);
+	void *ctx;
+	long begin;
+	long chunkSize;
+	std::vector<double> results;
+};
+
+void reduceChunk(long lo, long hi, void *arg)
+{
+	ReduceLoop *loop = (ReduceLoop *) arg;
+	loop->results[(lo - loop->begin) / loop->chunkSize] = loop->fn(lo, hi, loop->ctx);
+}
+
+} // anon namespace
+
+extern "C" void ccons_parallel_for(long begin, long end, long grain,
+                                   void (*fn)(long lo, long hi, void *ctx),
+                                   void *ctx)
+{
+	ThreadPool::instance()->parallelFor(begin, end, grain, fn, ctx);
+}
+
+extern "C" double ccons_parallel_reduce(long begin, long end, long grain,
+                                        double identity,
+                                        double (*fn)(long lo, long hi, void *ctx),
+                                        double (*combine)(double a, double b),
+                                        void *ctx)
+{
+	if (begin >= end)
+		return identity;
+	ThreadPool *pool = ThreadPool::instance();
+	ReduceLoop loop;
+	loop.fn = fn;
+	loop.ctx = ctx;
+	loop.begin = begin;
+	loop.chunkSize = pool->chunkSize(begin, end, grain);
+	// Inside another loop, the whole range is a single chunk, and the other
+	// partial results are left at the identity.
+	loop.results.assign((end - begin + loop.chunkSize - 1) / loop.chunkSize, identity);
+	pool->parallelFor(begin, end, loop.chunkSize, reduceChunk, &loop);
+
+	// Partial results are combined in order, so that the result does not
+	// depend on how the chunks were scheduled.
+	double result = identity;
+	for (unsigned i = 0; i < loop.results.size(); i++)
+		result = combine ? combine(result, loop.results[i]) : result + loop.results[i];
+	return result;
+}
+
+namespace ccons {
+
+static pthread_once_t runtimeOnce = PTHREAD_ONCE_INIT;
+
+static void addRuntimeSymbols()
+{
+	llvm::sys::DynamicLibrary::AddSymbol("ccons_parallel_for",
+	                                     (void *) ccons_parallel_for);
+	llvm::sys::DynamicLibrary::AddSymbol("ccons_parallel_reduce",
+	                                     (void *) ccons_parallel_reduce);
+}
+
+void RegisterParallelRuntime()
+{
+	pthread_once(&runtimeOnce, addRuntimeSymbols);
+}
+
+const char * GetParallelRuntimeDeclarations()
+{
+	return
+		"void ccons_parallel_for(long begin, long end, long grain,"
+		" void (*fn)(long lo, long hi, void *ctx), void *ctx);\n"
+		"double ccons_parallel_reduce(long begin, long end, long grain,"
+		" double identity, double (*fn)(long lo, long hi, void *ctx),"
+		" double (*combine)(double a, double b), void *ctx);";
+}
+
+} // namespace ccons
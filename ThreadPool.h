@@ -0,0 +1,105 @@
+#ifndef CCONS_THREAD_POOL_H
+#define CCONS_THREAD_POOL_H
+
+//
+// ThreadPool runs parallel loops for snippets, which reach it through the
+// ccons_parallel_for() and ccons_parallel_reduce() runtime functions. Each
+// thread works through a queue of chunks of its own, and steals half of
+// the remaining chunks of another thread once its queue runs dry. When a
+// chunk crashes, or the loop is interrupted, the remaining chunks are
+// skipped and the threads are stopped before the code that started the
+// loop is abandoned.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "Executor.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include <vector>
+
+namespace ccons {
+
+class ThreadPool {
+
+public:
+
+	// Returns the process-wide pool, which is shared by all consoles.
+	static ThreadPool * instance();
+
+	// The number of threads that run a parallel loop, including the one
+	// that started it.
+	unsigned size();
+	void setSize(unsigned size);
+
+	// Returns the number of iterations per chunk that a loop over
+	// [begin, end) is split into, given the requested grain, which may be
+	// 0 to pick one.
+	long chunkSize(long begin, long end, long grain);
+
+	// Runs fn(lo, hi, ctx) over consecutive chunks of [begin, end), in
+	// parallel, and returns once all of them have run. Loops started from
+	// within a loop run serially. If a chunk crashes or the loop is
+	// interrupted, abandons the code that the calling thread runs for its
+	// executor once no thread is running a chunk any longer.
+	void parallelFor(long begin, long end, long grain,
+	                 void (*fn)(long lo, long hi, void *ctx), void *ctx);
+
+private:
+
+	struct Queue {
+		pthread_mutex_t lock;
+		long next;  // the first chunk left to run
+		long last;  // one past the last chunk left to run
+	};
+
+	ThreadPool();
+
+	static void createInstance();
+	static void * threadMain(void *arg);
+
+	void startWorkers(unsigned count);
+	void stopWorkers();
+	void work(unsigned self);
+	bool takeChunk(unsigned self, long *chunk);
+	void waitForWorkers();
+
+	pid_t _owner;
+	pthread_mutex_t _loopMutex;  // held for the duration of a loop
+	pthread_mutex_t _mutex;
+	pthread_cond_t _wake;
+	pthread_cond_t _done;
+	std::vector<pthread_t> _workers;
+	std::vector<Queue*> _queues;
+	std::vector<Executor::Trap> _traps;  // one per queue
+	unsigned _generation;
+	unsigned _startGeneration;  // the generation when the workers started
+	unsigned _busy;
+	bool _quit;
+
+	// The loop being run.
+	long _begin;
+	long _end;
+	long _chunkSize;
+	void (*_fn)(long lo, long hi, void *ctx);
+	void *_ctx;
+	bool _flushDenormals;  // as set by the thread that started the loop
+	volatile sig_atomic_t _stopSignal;  // the signal that stopped the loop, if any
+
+};
+
+// Makes the parallel runtime functions available to JIT-compiled code.
+void RegisterParallelRuntime();
+
+// Returns the C declarations of the parallel runtime functions.
+const char * GetParallelRuntimeDeclarations();
+
+} // namespace ccons
+
+#endif // CCONS_THREAD_POOL_H
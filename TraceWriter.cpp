@@ -0,0 +1,63 @@
+//
+// Implementation of TraceWriter, which writes spans in the Chrome trace-event
+// JSON format.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "TraceWriter.h"
+
+#include <unistd.h>
+
+namespace ccons {
+
+TraceWriter::TraceWriter()
+	: _file(NULL)
+	, _pid(getpid())
+{
+}
+
+TraceWriter::~TraceWriter()
+{
+	if (_file)
+		fclose(_file);
+}
+
+bool TraceWriter::open(const std::string& path)
+{
+	if (_file)
+		fclose(_file);
+	_file = fopen(path.c_str(), "a");
+	if (!_file)
+		return false;
+	fseek(_file, 0, SEEK_END);
+	if (ftell(_file) == 0)
+		fputs("[\n", _file);
+	return true;
+}
+
+void TraceWriter::writeSpan(const char *name,
+                            uint64_t start,
+                            uint64_t duration,
+                            unsigned input,
+                            size_t inputSize)
+{
+	if (!_file)
+		return;
+	fprintf(_file,
+	        "{\"name\":\"%s\",\"cat\":\"ccons\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+	        "\"pid\":%d,\"tid\":%d,\"args\":{\"input\":%u,\"size\":%lu}},\n",
+	        name, start / 1e3, duration / 1e3, _pid, _pid,
+	        input, (unsigned long) inputSize);
+}
+
+void TraceWriter::flush()
+{
+	if (_file)
+		fflush(_file);
+}
+
+} // namespace ccons
@@ -0,0 +1,52 @@
+#ifndef CCONS_TRACE_WRITER_H
+#define CCONS_TRACE_WRITER_H
+
+//
+// TraceWriter writes spans in the Chrome trace-event JSON format, which can
+// be loaded into chrome://tracing or the Perfetto UI for offline analysis.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
+namespace ccons {
+
+class TraceWriter {
+
+public:
+
+	TraceWriter();
+	~TraceWriter();
+
+	// Open the trace file for appending. Uses the JSON array format, whose
+	// closing bracket is optional, so that the trace remains loadable even
+	// if the process crashes or several processes append to the same file.
+	bool open(const std::string& path);
+
+	// Write a complete event for a span of the specified duration, with the
+	// input number and its size as arguments. Times are in nanoseconds.
+	void writeSpan(const char *name,
+	               uint64_t start,
+	               uint64_t duration,
+	               unsigned input,
+	               size_t inputSize);
+
+	void flush();
+
+private:
+
+	FILE *_file;
+	int _pid;
+
+};
+
+} // namespace ccons
+
+#endif // CCONS_TRACE_WRITER_H
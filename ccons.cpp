@@ -10,6 +10,7 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <vector>
 
 #include <llvm/ADT/OwningPtr.h>
 #include <llvm/ADT/StringExtras.h>
@@ -21,6 +22,7 @@
 #include "EditLineReader.h"
 #include "InternalCommands.h"
 #include "RemoteConsole.h"
+#include "Server.h"
 
 using std::string;
 using ccons::Console;
@@ -30,6 +32,7 @@ using ccons::SerializedOutputConsole;
 using ccons::LineReader;
 using ccons::EditLineReader;
 using ccons::StdInLineReader;
+using ccons::SerializedInputReader;
 
 static llvm::cl::opt<bool>
 	DebugMode("ccons-debug",
@@ -43,26 +46,114 @@ static llvm::cl::opt<bool>
 static llvm::cl::opt<bool>
 	MultiProcess("ccons-multi-process",
 			llvm::cl::desc("Run in multi-process mode"));
+static llvm::cl::opt<unsigned>
+	Checkpoints("ccons-checkpoints",
+			llvm::cl::desc("Number of checkpoints to keep in multi-process mode"),
+			llvm::cl::value_desc("n"),
+			llvm::cl::init(4));
+static llvm::cl::opt<bool>
+	PrintUsage("ccons-rusage",
+			llvm::cl::desc("Print the resource usage of every input in multi-process mode"));
+static llvm::cl::opt<string>
+	ServerSocket("ccons-server",
+			llvm::cl::desc("Serve clients on the specified Unix domain socket"),
+			llvm::cl::value_desc("socket"));
+static llvm::cl::opt<unsigned>
+	ServerWorkers("ccons-server-workers",
+			llvm::cl::desc("Number of warm workers the server keeps waiting for clients"),
+			llvm::cl::value_desc("n"),
+			llvm::cl::init(8));
+static llvm::cl::opt<string>
+	ConnectSocket("ccons-connect",
+			llvm::cl::desc("Run in multi-process mode using the server on the specified socket"),
+			llvm::cl::value_desc("socket"));
+static llvm::cl::opt<unsigned>
+	StackSize("ccons-stack-size",
+			llvm::cl::desc("Stack size of the thread that statements are run on, in megabytes"),
+			llvm::cl::value_desc("MB"),
+			llvm::cl::init(64));
+static llvm::cl::opt<bool>
+	HugePages("ccons-huge-pages",
+			llvm::cl::desc("Back the memory of the JIT with transparent huge pages"));
+static llvm::cl::opt<string>
+	Standard("ccons-std",
+			llvm::cl::desc("C standard that input is parsed as: c99, gnu99, c11 or gnu11"),
+			llvm::cl::value_desc("standard"),
+			llvm::cl::init("gnu99"));
+static llvm::cl::opt<bool>
+	PrintTimings("ccons-timing",
+			llvm::cl::desc("Print a timing breakdown after every input"));
+static llvm::cl::opt<string>
+	TraceFile("ccons-trace",
+			llvm::cl::desc("Write Chrome trace-event JSON to the specified file"),
+			llvm::cl::value_desc("file"));
+
+// Returns the options that the child process of a RemoteConsole should
+// be started with, in order to behave like this one.
+static std::vector<string> getChildOptions()
+{
+	std::vector<string> options;
+	options.push_back("--ccons-checkpoints=" + llvm::utostr(Checkpoints));
+	options.push_back("--ccons-stack-size=" + llvm::utostr(StackSize));
+	options.push_back("--ccons-std=" + Standard);
+	if (HugePages)
+		options.push_back("--ccons-huge-pages");
+	if (PrintTimings)
+		options.push_back("--ccons-timing");
+	if (!TraceFile.empty())
+		options.push_back("--ccons-trace=" + TraceFile);
+	return options;
+}
+
+static Console * configureConsole(Console *console)
+{
+	console->setPrintTimings(PrintTimings);
+	console->setStackSize((size_t) StackSize << 20);
+	console->setHugePages(HugePages);
+	if (!console->setLanguageStandard(Standard))
+		std::cerr << "Unknown language standard '" << Standard << "'.\n";
+	if (!TraceFile.empty() && !console->setTraceFile(TraceFile))
+		std::cerr << "Could not open trace file '" << TraceFile << "'.\n";
+	return console;
+}
 
 static IConsole * createConsole(const char * command)
 {
-	if (MultiProcess)
-		return new RemoteConsole(command, DebugMode);
-	else if (SerializedOutput)
-		return new SerializedOutputConsole(DebugMode);		
-	else
-		return new Console(DebugMode);
+	if (!ConnectSocket.empty()) {
+		RemoteConsole *console = new RemoteConsole(ConnectSocket, DebugMode);
+		console->setMaxCheckpoints(Checkpoints);
+		console->setPrintUsage(PrintUsage);
+		return console;
+	} else if (MultiProcess) {
+		RemoteConsole *console = new RemoteConsole(command, getChildOptions(), DebugMode);
+		console->setMaxCheckpoints(Checkpoints);
+		console->setPrintUsage(PrintUsage);
+		return console;
+	} else if (SerializedOutput) {
+		SerializedOutputConsole *console = new SerializedOutputConsole(DebugMode);
+		console->setCheckpointsEnabled(Checkpoints > 0);
+		configureConsole(console->getConsole());
+		return console;
+	} else {
+		Console *console = configureConsole(new Console(DebugMode));
+		console->handleInterrupts();
+		console->guardCrashes();
+		return console;
+	}
 }
 
 static LineReader * createReader()
 {
-	if (UseStdIo)
+	if (SerializedOutput)
+		return new SerializedInputReader;
+	else if (UseStdIo)
 		return new StdInLineReader;
 	else
 		return new EditLineReader;
 }
 
 extern "C" void LLVMInitializeX86TargetMC();
+extern "C" void LLVMInitializeX86Disassembler();
 
 int main(const int argc, char **argv)
 {
@@ -75,9 +166,31 @@ int main(const int argc, char **argv)
 	}
 
 	LLVMInitializeNativeTarget();
+	LLVMInitializeX86TargetMC();
+	LLVMInitializeX86Disassembler();
+
+	// Consoles append to the trace file, since the child processes of a
+	// RemoteConsole share it; start out with an empty one.
+	if (!TraceFile.empty() && !SerializedOutput)
+		std::ofstream(TraceFile.c_str(), std::ios::trunc);
 
-	llvm::OwningPtr<IConsole> console(createConsole(argv[0]));
-	llvm::OwningPtr<LineReader> reader(createReader());
+	llvm::OwningPtr<IConsole> console;
+	llvm::OwningPtr<LineReader> reader;
+	if (!ServerSocket.empty()) {
+		// The console is warmed up once in the server, and every worker starts
+		// out with a copy of it.
+		Console *warm = configureConsole(new Console(DebugMode));
+		warm->warmUp();
+		if (!ccons::RunServer(ServerSocket, ServerWorkers))
+			return 1;
+		SerializedOutputConsole *worker = new SerializedOutputConsole(warm);
+		worker->setCheckpointsEnabled(Checkpoints > 0);
+		console.reset(worker);
+		reader.reset(new SerializedInputReader);
+	} else {
+		console.reset(createConsole(argv[0]));
+		reader.reset(createReader());
+	}
 
 	const char *line = reader->readLine(console->prompt(), console->input());
 	while (line) {
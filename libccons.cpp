@@ -0,0 +1,124 @@
+//
+// Implementation of the libccons C API on top of Console.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "libccons.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sstream>
+#include <string>
+
+#include <llvm/Support/Threading.h>
+#include <llvm-c/Target.h>
+
+#include "Console.h"
+
+using ccons::Console;
+
+extern "C" void LLVMInitializeX86TargetMC();
+extern "C" void LLVMInitializeX86Disassembler();
+
+struct ccons_session {
+	ccons_session() : console(false, output, error) {}
+
+	// The streams are declared first, since the console refers to them.
+	std::ostringstream output;
+	std::ostringstream error;
+	Console console;
+};
+
+static pthread_once_t targetOnce = PTHREAD_ONCE_INIT;
+
+static void initializeTarget()
+{
+	// Sessions may be created and used from several threads.
+	llvm::llvm_start_multithreaded();
+	LLVMInitializeNativeTarget();
+	LLVMInitializeX86TargetMC();
+	LLVMInitializeX86Disassembler();
+}
+
+static char * copyString(const std::string& str)
+{
+	char *copy = (char *) malloc(str.length() + 1);
+	if (copy)
+		memcpy(copy, str.c_str(), str.length() + 1);
+	return copy;
+}
+
+static ccons_status toStatus(Console::InputStatus status)
+{
+	switch (status) {
+		case Console::InputFailed:
+			return CCONS_ERROR;
+		case Console::InputIncomplete:
+			return CCONS_INCOMPLETE;
+		default:
+			return CCONS_OK;
+	}
+}
+
+extern "C" ccons_session * ccons_session_new(void)
+{
+	pthread_once(&targetOnce, initializeTarget);
+	return new ccons_session;
+}
+
+extern "C" ccons_status ccons_eval(ccons_session *session, const char *src,
+                                   ccons_result *result)
+{
+	session->output.str("");
+	session->error.str("");
+
+	// The console processes its input line by line.
+	ccons_status status = CCONS_OK;
+	std::string source(src);
+	std::string::size_type start = 0;
+	while (start < source.length()) {
+		std::string::size_type end = source.find('\n', start);
+		if (end == std::string::npos)
+			end = source.length();
+		// Lines reach the console with their newline, as when typed, which
+		// ends a // comment or a preprocessor directive.
+		std::string line = source.substr(start, end - start) + "\n";
+		start = end + 1;
+		session->console.process(line.c_str());
+		ccons_status lineStatus = toStatus(session->console.lastInputStatus());
+		// An error is reported even if later lines were fine.
+		if (status != CCONS_ERROR)
+			status = lineStatus;
+	}
+
+	if (result) {
+		result->status = status;
+		result->output = copyString(session->output.str());
+		result->error = copyString(session->error.str());
+	}
+	return status;
+}
+
+extern "C" void ccons_result_free(ccons_result *result)
+{
+	free(result->output);
+	free(result->error);
+	result->output = NULL;
+	result->error = NULL;
+}
+
+extern "C" void * ccons_lookup_symbol(ccons_session *session, const char *name)
+{
+	return session->console.lookupSymbol(name);
+}
+
+extern "C" void ccons_session_free(ccons_session *session)
+{
+	delete session;
+}
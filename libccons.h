@@ -0,0 +1,71 @@
+#ifndef CCONS_LIBCCONS_H
+#define CCONS_LIBCCONS_H
+
+/*
+ * C API of libccons, for evaluating C code in-process from a program that
+ * embeds the ccons interpreter.
+ *
+ * A session behaves like an interactive ccons console: declarations and
+ * variables persist from one evaluation to the next, and the value of an
+ * expression statement is reported in the output. Code that is run prints
+ * to the standard output of the process, as usual.
+ *
+ * Each session has its own LLVM context, diagnostics and output, so
+ * different sessions may be used concurrently from different threads. A
+ * single session must not be used by two threads at once.
+ *
+ * Part of ccons, the interactive console for the C programming language.
+ *
+ * Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+ * terms of MIT Open Source License. See file LICENSE for details.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ccons_session ccons_session;
+
+typedef enum {
+	CCONS_OK,         /* the source was evaluated without errors */
+	CCONS_ERROR,      /* the source was ignored due to errors */
+	CCONS_INCOMPLETE  /* more source is needed, e.g. an unclosed brace */
+} ccons_status;
+
+typedef struct {
+	ccons_status status;
+	char *output;  /* what the console printed, e.g. values of expressions */
+	char *error;   /* diagnostics */
+} ccons_result;
+
+/* Creates a new session, or returns NULL on failure. */
+ccons_session * ccons_session_new(void);
+
+/*
+ * Evaluates the specified source, which may span several lines. Source that
+ * is incomplete is kept, and completed by the next evaluation.
+ *
+ * If result is not NULL, it receives the outcome, and must be released with
+ * ccons_result_free().
+ */
+ccons_status ccons_eval(ccons_session *session, const char *src,
+                        ccons_result *result);
+
+/* Releases the strings of a result filled in by ccons_eval(). */
+void ccons_result_free(ccons_result *result);
+
+/*
+ * Returns the address of a function or global variable defined in the
+ * session, or NULL if there is none. The address stays valid until the
+ * session is freed.
+ */
+void * ccons_lookup_symbol(ccons_session *session, const char *name);
+
+/* Frees a session along with all the code and data it defined. */
+void ccons_session_free(ccons_session *session);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* CCONS_LIBCCONS_H */
@@ -0,0 +1,72 @@
+//
+// Implementation of spawn2() which starts a process with its standard input
+// and output connected to pipes, without going through the shell.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#include "spawn2.h"
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define READ 0
+#define WRITE 1
+
+extern char **environ;
+
+pid_t spawn2(char *const argv[], int *infp, int *outfp)
+{
+	int p_stdin[2], p_stdout[2];
+	posix_spawn_file_actions_t actions;
+	pid_t pid;
+	int i, err;
+
+	if (pipe(p_stdin) != 0)
+		return -1;
+	if (pipe(p_stdout) != 0) {
+		close(p_stdin[READ]);
+		close(p_stdin[WRITE]);
+		return -1;
+	}
+
+	// None of the pipe ends should leak into other children; dup2() clears
+	// the flag on the copies that become the child's stdin and stdout.
+	for (i = 0; i < 2; i++) {
+		fcntl(p_stdin[i], F_SETFD, FD_CLOEXEC);
+		fcntl(p_stdout[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, p_stdin[READ], READ);
+	posix_spawn_file_actions_adddup2(&actions, p_stdout[WRITE], WRITE);
+	err = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+
+	close(p_stdin[READ]);
+	close(p_stdout[WRITE]);
+	if (err != 0) {
+		close(p_stdin[WRITE]);
+		close(p_stdout[READ]);
+		return -1;
+	}
+
+	if (infp == NULL)
+		close(p_stdin[WRITE]);
+	else
+		*infp = p_stdin[WRITE];
+
+	if (outfp == NULL)
+		close(p_stdout[READ]);
+	else
+		*outfp = p_stdout[READ];
+
+	return pid;
+}
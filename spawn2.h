@@ -0,0 +1,30 @@
+#ifndef CCONS_SPAWN2_H
+#define CCONS_SPAWN2_H
+
+//
+// Header file for spawn2.c, which declares the spawn2() function for
+// starting a process connected to the caller by a pair of pipes.
+//
+// Part of ccons, the interactive console for the C programming language.
+//
+// Copyright (c) 2009 Alexei Svitkine. This file is distributed under the
+// terms of MIT Open Source License. See file LICENSE for details.
+//
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <unistd.h>
+
+// Runs argv[0], searched for in PATH, with the specified NULL-terminated
+// arguments. No shell is involved. The standard input and output of the
+// new process are connected to *infp and *outfp respectively, which are
+// not inherited by processes spawned later.
+pid_t spawn2(char *const argv[], int *infp, int *outfp);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // CCONS_SPAWN2_H